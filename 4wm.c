@@ -2,24 +2,52 @@
 
 #define _DEFAULT_SOURCE
 #include <stdlib.h>
+#include <ctype.h>
+#include <dirent.h>
 #include <stdio.h>
 #include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <malloc.h>
 #include <stdarg.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <string.h>
 #include <signal.h>
+#include <spawn.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <sys/types.h>
+#include <poll.h>
 #include <pwd.h>
+#include <sched.h>
+#include <libgen.h>
+#include <time.h>
 #include <X11/keysym.h>
 #include <X11/Xresource.h>
 #include <xcb/randr.h>
 #include <xcb/xcb.h>
+#include <xcb/xcbext.h>
 #include <xcb/xcb_atom.h>
 #include <xcb/xcb_icccm.h>
 #include <xcb/xcb_keysyms.h>
 #include <xcb/xcb_ewmh.h>
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#elif defined(__SSE2__)
+#  include <emmintrin.h>
+#endif
 
 /* set this to 1 to enable debug prints */
 #if 0
@@ -29,8 +57,10 @@
 #  define DEBUG(x)      ;
 #  define DEBUGP(x,...) ;
 #endif
+// tracepoints are always compiled in, they cost a branch while tracing is off
+#define TRACE(p,w,e,start,arg) do { if (tracing) tracepoint(p, w, e, start, arg); } while (0)
 
-#define USAGE           "usage: 4wm [-h] [-v]"
+#define USAGE           "usage: 4wm [-h] [-v] [-T] [-t] [-l] [-d tracefile] [-r file | -p file] [-b rounds] [-S rounds]"
 #define XCB_MOVE_RESIZE XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y | XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT
 #define XCB_MOVE        XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y
 #define XCB_RESIZE      XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT
@@ -41,9 +71,14 @@
 #define ISFT(c)        (c->isfloating || c->istransient)
 
 enum { RESIZE, MOVE };
+enum { POLL_X, POLL_RELOAD, POLL_SIGNAL, POLL_CHILDREN };  // slots in pollfds, one per proc from POLL_CHILDREN on
+enum { REC_EVENT, REC_COMMIT, REC_ATOM, REC_PROPERTY, REC_REPLY, REC_KEYSYM };
+enum { TP_EVENT, TP_COMMIT, TP_MANAGE, TP_RETILE, TP_BORDERS, TP_FOCUS, TP_WINTOCLIENT, TP_COUNT };    // what a trace record is about, see tracepoint()
+enum { LATENCY_REALTIME = 1, LATENCY_NICE = 2, LATENCY_LOCKED = 4, LATENCY_LOCKFUTURE = 8, LATENCY_PREFAULTED = 16 };
+enum { COL_FOCUS, COL_UNFOCUS, COL_OUTER, COL_FLOAT, BORDER_COLORS };
 enum { TILE, MONOCLE, VIDEO, FLOAT };
 enum { TLEFT, TRIGHT, TBOTTOM, TTOP, TDIRECS };
-enum { WM_PROTOCOLS, WM_DELETE_WINDOW, WM_COUNT };
+enum { WM_PROTOCOLS, WM_DELETE_WINDOW, WM_STATE, WM_COUNT };
 enum { NET_SUPPORTED, NET_FULLSCREEN, NET_WM_STATE, NET_ACTIVE, NET_WM_NAME, NET_COUNT };
 
 /* a client is a wrapper to a window that additionally
@@ -62,9 +97,151 @@ typedef struct client {
     int xp, yp, wp, hp;             // percent of monitor, before adjustment (percent is a int from 0-100)
     bool istransient, isfloating;   // property flags
     xcb_window_t win;               // the window this client is representing
-    char *title;
+    int slot;                       // its place in the geometry of its desktop, see geomstore
+    pid_t pid;                      // from _NET_WM_PID, 0 if unknown
+    const char *title;              // interned, see interntitle()
+    unsigned int titlereq[2];       // pending _NET_WM_NAME and WM_NAME requests
+    int64_t titletime;              // when the title was last requested, in ms
+    bool titlepending, titlestale;  // requested but not received / changed but not requested
 } client;
 
+/* the rects of a desktop's clients as they were last configured and their
+ * tiles, an array per coordinate indexed by client.slot, for hit tests and
+ * edge matches that run over them GEOM_LANES at a time. slots are in the
+ * order of the client list, the arrays are padded with empty rects
+ *
+ * x0, y0, x1, y1     - the rect, x1 and y1 exclusive
+ * xp0, yp0, xp1, yp1 - the tile in percent, xp1 is xp + wp, see geomtile()
+ * tiled              - -1 for tiled clients, 0 for floating and transient ones
+ */
+typedef struct {
+    int32_t *x0, *y0, *x1, *y1, *xp0, *yp0, *xp1, *yp1, *tiled;
+    client **owner;
+    int n, max;
+} geomstore;
+
+#define GEOM_LANES      8
+#define GEOM_ARRAYS     9   // int32_t arrays in a geomstore
+
+#define TITLE_BUCKETS   256
+
+// a title shared by the clients showing it, str is what client.title points to
+typedef struct titlestr {
+    struct titlestr *next;
+    int refs, len;
+    char str[];
+} titlestr;
+
+/* a child started by launch(), waited for through a pidfd in the main
+ * loop, or found in reapedpids after sigchld() reaped it on kernels
+ * without pidfds
+ *
+ * done     - called from the main loop once it exited, may be NULL
+ * win      - its first window, once that mapped
+ */
+typedef struct {
+    pid_t pid;
+    void (*done)(pid_t pid);
+    xcb_window_t win;
+} proc;
+
+// where launch() found a command on $PATH
+typedef struct cmdpath {
+    char *name, *path;
+    struct cmdpath *next;
+} cmdpath;
+
+/* a slab allocator for objects of one size, see poolget(). slabs hold
+ * POOL_SLAB objects and are only given back by pooldestroy()
+ *
+ * free  - objects put back, each holding the next
+ * slabs - each slab starts with the one allocated before it
+ */
+typedef struct {
+    size_t size;
+    void *free, *slabs;
+} pool;
+
+#define POOL_SLAB       64
+#define POOL(type)      { .size = (sizeof(type) + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1) }
+
+/* memory that lives until the event being handled is done, see
+ * scratchalloc(). what does not fit is malloc'd and freed by
+ * scratchreset(), which grows the arena to fit it the next time
+ */
+typedef struct {
+    char *base;
+    size_t used, size, spilled;
+    void **spill;
+    int nspill, maxspill;
+} arena;
+
+#define SCRATCH_SIZE    4096
+
+// an entry in a table made by lookupid()
+typedef struct {
+    uint32_t from, to;
+} idpair;
+
+/* the requests 4wm sends without waiting for an answer, xb is xcbbackend,
+ * or fakebackend for -b. the arguments are those of the xcb_* request less
+ * the connection. requests that need a reply still go to dis
+ */
+typedef struct {
+    uint32_t (*id)(void);
+    void (*configure)(xcb_window_t win, uint16_t mask, const void *values);
+    void (*map)(xcb_window_t win);
+    void (*unmap)(xcb_window_t win);
+    void (*property)(uint8_t mode, xcb_window_t win, xcb_atom_t prop, xcb_atom_t type, uint8_t format, uint32_t len, const void *data);
+    void (*focus)(uint8_t revert, xcb_window_t win, xcb_timestamp_t time);
+    void (*attributes)(xcb_window_t win, uint32_t mask, const void *values);
+    void (*grabkey)(uint8_t owner, xcb_window_t win, uint16_t mods, xcb_keycode_t key, uint8_t pmode, uint8_t kmode);
+    void (*ungrabkey)(xcb_keycode_t key, xcb_window_t win, uint16_t mods);
+    void (*grabbutton)(uint8_t owner, xcb_window_t win, uint16_t mask, uint8_t pmode, uint8_t kmode, xcb_window_t confine, xcb_cursor_t cursor, uint8_t button, uint16_t mods);
+    void (*ungrabbutton)(uint8_t button, xcb_window_t win, uint16_t mods);
+    void (*pixmap)(uint8_t depth, xcb_pixmap_t pmap, xcb_drawable_t drawable, uint16_t w, uint16_t h);
+    void (*freepixmap)(xcb_pixmap_t pmap);
+    void (*gc)(xcb_gcontext_t gc, xcb_drawable_t drawable, uint32_t mask, const void *values);
+    void (*changegc)(xcb_gcontext_t gc, uint32_t mask, const void *values);
+    void (*freegc)(xcb_gcontext_t gc);
+    void (*fill)(xcb_drawable_t drawable, xcb_gcontext_t gc, uint32_t n, const xcb_rectangle_t *rects);
+    void (*copy)(xcb_drawable_t src, xcb_drawable_t dst, xcb_gcontext_t gc, int16_t sx, int16_t sy, int16_t dx, int16_t dy, uint16_t w, uint16_t h);
+    void (*text)(uint8_t len, xcb_drawable_t drawable, xcb_gcontext_t gc, int16_t x, int16_t y, const char *str);
+    void (*send)(uint8_t propagate, xcb_window_t win, uint32_t mask, const char *event);
+    void (*flush)(void);
+} backend;
+
+/* a window as the fake backend sees it, stack goes up when it is raised.
+ * transient, types and class are the properties manage() reads, set by
+ * replay() from the recording
+ */
+typedef struct {
+    xcb_window_t id, transient;
+    int x, y, w, h, border, stack, ntypes;
+    bool mapped;
+    xcb_atom_t types[4];
+    char class[64];
+} fakewin;
+
+/* the fake backend, an X server in memory that keeps what the requests
+ * did to windows and counts them, for -b and -p
+ *
+ * ids   - window id to its index in wins, plus one, see lookupid()
+ * atoms - the names of the atoms fakeatom() made, the first is
+ *         XCB_ATOM_WM_TRANSIENT_FOR + 1
+ */
+typedef struct {
+    unsigned long requests, configures, maps, properties, focuses, grabs, draws;
+    xcb_window_t focus;
+    uint32_t nextid;
+    fakewin *wins;
+    int nwins, maxwins;
+    idpair *ids;
+    int sids, nids;
+    char (*atoms)[32];
+    int natoms, maxatoms;
+} fakeserver;
+
 /* properties of each desktop
  * mode         - the desktop's tiling layout mode
  * gap          - the desktops gap size
@@ -88,8 +265,42 @@ typedef struct monitor {
     struct monitor *next;   // the next monitor after this one
     int curr_dtop;          // which desktop the monitor is displaying
     bool haspanel;          // does this monitor display a panel
+    struct bar *bar;        // the built-in status bar, or NULL
 } monitor;
 
+/* the layout restart() hands to the next 4wm, in a memfd given with -R
+ *
+ * a statehdr, then a deskstate for every desktop, a monstate for every
+ * monitor, a clientstate for every client, desktop by desktop in list
+ * order, and the pids of the children still running
+ *
+ * current and prevfocus are indexes in the desktop's client list, or -1
+ */
+#define STATE_MAGIC     0x34776d72  // "4wmr"
+#define STATE_VERSION   1
+typedef struct {
+    uint32_t magic, version;
+    uint32_t ndesktops, nmons, nclients, nprocs;
+    int32_t selmon;
+} statehdr;
+
+typedef struct {
+    int32_t mode, gap, direction, count, current, prevfocus;
+    uint8_t showpanel;
+} deskstate;
+
+typedef struct {
+    uint32_t id;
+    int32_t curr_dtop;
+} monstate;
+
+typedef struct {
+    uint32_t win;
+    int32_t desktop, pid;
+    int32_t x, y, w, h, xp, yp, wp, hp;
+    uint8_t istransient, isfloating;
+} clientstate;
+
 //argument structure to be passed to function by config.h 
 typedef struct {
     const char** com;                                                       // a command to run
@@ -113,26 +324,47 @@ typedef struct {
     const Arg arg;              // the argument to the function
 } Button;
 
+/* a menu is laid out on a grid of 100x60 cells centered on the monitor,
+ * entries spiral out from the middle and go on to the next page once
+ * every cell is taken.
+ *
+ * grid     - the entry in each cell, indexed by page * cols * rows + cell,
+ *            where cell is row * cols + col. NULL for an empty cell
+ * ox, oy   - where the grid starts in win
+ * page     - the page shown
+ * sel      - the cell selected with the keyboard, -1 for none
+ */
 typedef struct Menu {
     char **list;                // list to hold the original list of commands
     struct Menu *next;          // next menu incase of multiple
     struct Menu_Entry *head;
+    struct Menu_Entry **grid;
+    int cols, rows, npages, ox, oy;
+    int page, sel;
+    xcb_window_t win;           // the launcher window, created once and mapped on launch
+    xcb_pixmap_t *pmaps;        // each page fully drawn, copied into win on expose
+    int w, h;                   // size of win and the pixmaps
 } Menu;
 
 typedef struct Menu_Entry {
     char *cmd[2];                               // cmd to be executed
     int x, y;                                   // w and h will be default or defined
-    struct Menu_Entry *next, *b, *l, *r, *t;    // next and neighboring entries
-    xcb_rectangle_t *rectangles;                // tiles to draw
+    int page, cell;                             // where it is in the menu's grid
+    struct Menu_Entry *next;                    // next entry
+    xcb_rectangle_t rectangle;                  // the tile to draw
 } Menu_Entry;
 
 typedef struct Xresources {
     unsigned int color[12];
     xcb_gcontext_t gc_color[12];
     xcb_gcontext_t font_gc[12];
+    xcb_gcontext_t gc_clear;        // fills with black
+    xcb_gcontext_t gc_copy;         // copies pixmaps, no graphics exposures
+    xcb_gcontext_t gc_text;         // white text on black
 } Xresources;
 
 // COMMANDS
+void applylayout(const Arg *arg);
 void change_desktop(const Arg *arg);
 void changegap(const Arg *arg);
 void client_to_desktop(const Arg *arg);
@@ -147,14 +379,336 @@ void pulltofloat();
 void pushtotiling();
 void quit(const Arg *arg);
 void resizeclient(const Arg *arg);
+void restart(const Arg *arg);
 void rotate(const Arg *arg);
 void rotate_filled(const Arg *arg);
+void savelayout(const Arg *arg);
 void spawn(const Arg *arg);
+void spawnon(const Arg *arg);
 void switch_mode(const Arg *arg);
 void switch_direction(const Arg *arg);
+void toggletrace(const Arg *arg);
 
 #include "config.h"
 
+#if LAYOUTS
+/* a tile of a layout saved by savelayout(), in percent of the monitor, and
+ * the WM_CLASS class of the window that sat in it. the tiles of an applied
+ * layout that found no window wait in pending[] for one to map. a window
+ * closing next to one with no window to take its space hands it to the
+ * empty tile, see refitslot()
+ */
+typedef struct {
+    int xp, yp, wp, hp;
+    char class[64];
+} layoutslot;
+#endif
+
+#if RESERVE_SLOTS
+#define SLOT_TIMEOUT    30000   // ms a reserved slot waits for its window
+
+/* a tile held for a window being launched by spawn() or spawnon()
+ *
+ * pid      - of the launched child, matched against _NET_WM_PID
+ * id       - the DESKTOP_STARTUP_ID it was given, matched against _NET_STARTUP_ID
+ * desktop  - where the window goes
+ * target   - the window whose tile it splits, 0 for whatever is current then
+ * time     - when it was reserved, 0 for a free slot
+ */
+struct slot {
+    pid_t pid;
+    char id[48];
+    int desktop;
+    xcb_window_t target;
+    int64_t time;
+};
+#endif
+
+#if READER
+#define READER_RING     1024    // events reader() can queue, a power of two
+
+/* an event reader() took off the socket, waiting for the main thread
+ *
+ * ev   - as xcb_wait_for_event() returned it
+ * time - us since boot, when it was read
+ */
+typedef struct {
+    xcb_generic_event_t *ev;
+    int64_t time;
+} queuedevent;
+#endif
+
+#define MAPBURST_BUCKETS    5
+#define LAYOUT_SPANS        8   // batches whose crossing events enternotify() can tell apart
+#define LATENCY_HEAP        (1024 * 1024)   // heap lowlatency() touches up front
+#define LATENCY_STACK       (256 * 1024)    // and stack
+#ifndef SCHED_RESET_ON_FORK                 // only declared with _GNU_SOURCE
+#define SCHED_RESET_ON_FORK 0x40000000
+#endif
+#define BENCH_WINDOWS       8   // windows each round of bench() opens
+#define SOAK_WINDOWS        32  // windows each round of soak() opens
+#define SOAK_RSS            (1024 * 1024)   // growth soak() allows, in bytes
+#define SOAK_HEAP           (64 * 1024)
+#define REAPED_PIDS         64  // pids sigchld() reaped that reapchildren() has yet to see, a power of two
+/* the sequence numbers of the requests one batch of events and its commit()
+ * sent to move, map or unmap windows. the server stamps a crossing event
+ * with the last request it ran, if that is one of these a window moved
+ * under the pointer and the pointer itself did not. spans more than 65535
+ * requests old are dropped, see expirespans()
+ */
+typedef struct {
+    uint32_t first, last;
+} seqspan;
+
+#define HANDLER_COMMIT      1   // commit() where handlers are told apart by event type, 1 is never an event
+#define HANDLER_NONE        -1  // outside of any handler, setup() and the main loop
+
+#define TRACE_MAGIC         0x74777734  // "4wwt" in little endian
+#define TRACE_SIZE          8192        // records in the ring, a power of two
+
+/* a trace record, TRACE_SIZE of them are kept in a ring and written out by
+ * dumptrace(), 4wm -d prints them as a timeline
+ *
+ * time     - us since boot, when the record was made
+ * duration - us the traced thing took, 0 if it isn't timed
+ * window   - the window it was about, or 0
+ * point    - where the record was made, one of TP_*
+ * event    - the event type for TP_EVENT
+ * arg      - what it means depends on point
+ */
+typedef struct {
+    uint64_t time;
+    uint32_t duration, window;
+    uint16_t point;
+    uint8_t event, pad;
+    uint32_t arg;
+} tracerec;
+
+// what dumptrace() writes before the records, head counts every record made
+typedef struct {
+    uint32_t magic, size;
+    uint64_t head;
+} tracehdr;
+
+#define RECORD_MAGIC        0x63657234  // "4rec" in little endian
+#define RECORD_VERSION      4
+#define RECORD_MAX          65536   // bytes in one record, a reply of RandR can be big
+
+/* a session recorded with -r and replayed with -p, a recordhdr and then
+ * records, each a recordrec followed by len bytes of
+ *
+ * REC_EVENT    - the event as it was received, 32 bytes. an EnterNotify
+ *                has 1 for a sequence if ourcrossing() ignored it, else 0
+ * REC_COMMIT   - run() committed the events since the last one
+ * REC_ATOM     - the uint32_t value of an atom the next event uses, then
+ *                its name, as atoms differ between servers
+ * REC_PROPERTY - a recprop, then the value of a property manage() reads
+ *                from a window that asked to be mapped. the value of an
+ *                ATOM property is the names, each ending in a NUL
+ * REC_REPLY    - a reply a handler acted on, as the server sent it, or
+ *                nothing if there was none, see RECREPLY
+ * REC_KEYSYM   - the uint32_t keycode of the next key event, then the
+ *                keysyms without and with Shift, as keymaps differ too
+ *
+ * root is the root window of the recorded screen, width and height its
+ * size, randr the first event of RandR there or -1, time is in us since
+ * the recording started
+ */
+typedef struct {
+    uint32_t magic, version, root;
+    int32_t randr;
+    uint32_t width, height;
+} recordhdr;
+
+typedef struct {
+    uint32_t kind, len;
+    uint64_t time;
+} recordrec;
+
+typedef struct {
+    uint32_t window, format;
+    char name[32], type[32];
+} recprop;
+
+/* where replay() is in a recording. handlers that wait for more events or
+ * for replies read on through nextrecord() too
+ *
+ * ids, atoms - the recorded ones and what stands in for them here
+ * randr      - the first event of RandR on the recorded server
+ * keysyms    - the recorded keysyms of each keycode, see xcb_get_keysym()
+ * r, buf     - the last record nextrecord() returned, its payload
+ * held       - r was handed back with holdrecord() and comes again
+ */
+typedef struct {
+    FILE *f;
+    const char *file;
+    idpair *ids, *atoms;
+    int nids, sids, natoms, satoms;
+    int randr;
+    xcb_keysym_t keysyms[256][2];
+    recordrec r;
+    bool held;
+    char buf[RECORD_MAX + 1];
+} replayer;
+
+#if METRICS
+#define METRIC_BUCKETS      22  // 1us, 2us, 4us .. 2^20us and +Inf
+#define COUNT(f)            (stats.f++)
+
+/* time spent in one kind of handler, bucket i counts the calls that took
+ * less than 2^i us, the last one every call
+ */
+typedef struct {
+    unsigned long count;
+    uint64_t sum;                   // in us
+    unsigned long buckets[METRIC_BUCKETS];
+} histogram;
+#else
+#define COUNT(f)            ((void)0)
+#endif
+
+/* XREPLY wraps every wait for a reply or a request check. it counts them
+ * for the metrics, and with AUDIT times them for auditreport(), by the
+ * function and line that waited and the handler it was called from
+ */
+#if AUDIT
+#define AUDIT_SITES         256
+#define XREPLY(call)        (auditbegin(), _Generic((call), uint8_t: auditend8, default: auditendp)(__func__, __LINE__, (call)))
+
+// one place that waited for the server, while handling one type of event
+typedef struct {
+    const char *func;
+    int line, handler;
+    unsigned long count;
+    long total, max;                // in us
+} auditsite;
+#else
+#define XREPLY(call)        (COUNT(replywaits), (call))
+#endif
+#define FLUSH()             (COUNT(flushes), xb->flush())
+// a reply that differs between servers, recorded with -r and played back with -p
+#define RECREPLY(call)      recordreply(XREPLY(call))
+
+#if SNAPSHOT
+#define SNAPSHOT_MAGIC      0x736d7734  // "4wms" in little endian
+#define SNAPSHOT_VERSION    4
+#define SNAPSHOT_MONS       8
+#define SNAPSHOT_CLIENTS    256
+
+/* the state published for panels and pagers, every field is 32 bits wide
+ * so readers in any language can map it without caring about padding
+ *
+ * seldesktop   - the desktop shown on the selected monitor
+ * selmon       - index of the selected monitor in mons
+ * nmons        - number of valid entries in mons
+ * nclients     - number of valid entries in clients, at most SNAPSHOT_CLIENTS
+ * desktops     - per desktop layout, current is the focused window or 0
+ * mons         - per monitor geometry and the desktop it displays
+ * clients      - every managed window and the desktop it lives on
+ * stats        - counters, see wmstats
+ */
+typedef struct {
+    int32_t seldesktop, selmon, nmons, nclients;
+    struct { int32_t mode, direction, gap, showpanel, count, nclients; uint32_t current, prevfocus; } desktops[DESKTOPS];
+    struct { uint32_t id; int32_t x, y, w, h, desktop, haspanel; } mons[SNAPSHOT_MONS];
+    struct { uint32_t win; int32_t desktop, x, y, w, h, isfloating, istransient; } clients[SNAPSHOT_CLIENTS];
+    struct { uint32_t titlessuppressed, mapbursts[MAPBURST_BUCKETS], mapburstmax, latency; } stats;
+} snapstate;
+
+/* the memory mapped state file
+ *
+ * seq is a seqlock, it is odd while the wm is writing. a reader copies
+ * state, then rereads seq and retries if it was odd or has changed
+ */
+typedef struct {
+    uint32_t magic, version, ndesktops;
+    _Atomic uint32_t seq;
+    snapstate state;
+} snapshot;
+#endif
+
+#if MENU_SEARCH
+#define PATHINDEX_MAGIC 0x69707734  // "4wpi" in little endian
+
+/* the index of every executable on $PATH, kept in a memory mapped file
+ *
+ * the file is the header, count entries sorted by name, then the strings.
+ * signature is a hash of $PATH and the mtime of each of its directories,
+ * when it no longer matches the index is rebuilt in the background.
+ * the mapping is shared, so launches is counted right in the file
+ */
+typedef struct {
+    uint32_t magic, count;
+    uint64_t signature;
+} pathindexhdr;
+
+typedef struct {
+    uint32_t name, dir;         // offsets into the strings
+    uint32_t len;               // length of name
+    uint32_t launches;          // how often it was launched from the menu
+} pathentry;
+
+/* the mapped index and the state of the search typed into the open menu
+ *
+ * cand     - the entries matching query, typing another character only
+ *            needs to look at these
+ * results  - the best MENU_RESULTS of cand, sel is the highlighted one
+ * rebuild  - the child rebuilding the index, or 0
+ */
+typedef struct {
+    char file[PATH_MAX];
+    pathindexhdr *hdr;
+    size_t size;
+    pathentry *entries;
+    char *strings;
+    ino_t ino;
+    struct timespec mtime;
+    pid_t rebuild;
+    char query[64];
+    int qlen, sel, nresults;
+    uint32_t *cand, ncand;
+    uint32_t results[MENU_RESULTS];
+} pathindex;
+#endif
+
+// title tracking is only needed when there is something to show it
+#define STATUS (PRETTY_PRINT || BAR)
+
+#if BAR
+#define BAR_GLYPHS  95          // printable ascii, ' ' to '~'
+#define BAR_CELLS   256         // max glyphs in a segment
+enum { BAR_CURRENT, BAR_VISIBLE, BAR_HIDDEN, BAR_MODE, BAR_DIR, BAR_TITLE, BAR_COLORS };
+enum { SEG_WS, SEG_MODE, SEG_DIR, SEG_TITLE, SEG_COUNT };
+
+/* a status bar drawn by the wm itself
+ *
+ * the bar is split into segments, each one holds the cells drawn last
+ * time, a cell is a glyph in the low byte and a color in the high byte.
+ * only segments whose cells changed, or that moved, are redrawn
+ *
+ * damaged  - everything must be redrawn, e.g. after an expose
+ */
+typedef struct bar {
+    xcb_window_t win;
+    int x, y, w;
+    uint16_t cells[SEG_COUNT][BAR_CELLS];
+    int len[SEG_COUNT];
+    bool damaged;
+} bar;
+
+/* the glyph atlas shared by all bars
+ *
+ * every printable glyph is rendered once per color into pmap, a row per
+ * color, so drawing text is copying cells out of it
+ */
+typedef struct {
+    xcb_pixmap_t pmap;
+    xcb_gcontext_t gc;      // persistent, its foreground is the background color
+    unsigned int bg;
+    int cw, ch, ascent;     // cell size and baseline
+} baratlas;
+#endif
+
 #if PRETTY_PRINT
 typedef struct pp_data {
     char *ws;
@@ -168,35 +722,259 @@ client** clientstotheleft(client *w, desktop *d, bool samesize);
 client** clientstotheright(client *w, desktop *d, bool samesize);
 client** clientstothetop(client *w, desktop *d, bool samesize);
 Menu_Entry* createmenuentry(int x, int y, int w, int h, char *cmd);
+monitor* createmon(xcb_randr_output_t id, int x, int y, int w, int h, int dtop);
+void closemenu(void);
 void deletewindow(xcb_window_t w);
 #if PRETTY_PRINT
 void desktopinfo(void);
 #endif
+#if BAR
+void drawbars(void);
+#endif
+#if LAYOUTS
+bool refitslot(const client *r, const desktop *d);
+bool fillslot(client *c, int desktop, xcb_get_property_cookie_t cookie);
+#endif
 void focus(client *c, desktop *d, const monitor *m);
+#if LAYOUTS
+void getclasses(client **cs, int n, char (*classes)[64]);
+#endif
+void grabbuttons(client *c);
+pid_t launch(const char **argv, const char *startupid, void (*done)(pid_t pid));
+void loadcolors(unsigned int *border, unsigned int *menu);
+#if LAYOUTS
+bool layoutpath(const char *name, char *path, size_t size);
+int loadlayout(const char *name, layoutslot **slots);
+#endif
 void* malloc_safe(size_t size);
+void geomadd(const desktop *d, client *c);
+int geomedge(const desktop *d, int edge, int value, client **out);
+client* geomhit(const desktop *d, int x, int y);
+void geomremove(const desktop *d, client *c);
+void geomset(const desktop *d, const client *c, int x, int y, int w, int h);
+void geomtile(const desktop *d, const client *c);
+void pooldestroy(pool *p);
+void* poolget(pool *p);
+void poolput(pool *p, void *obj);
+void* scratchalloc(size_t size);
+void scratchreset(void);
+void endlayout(void);
+void layoutrequest(unsigned int seq);
+void expirespans(uint32_t seq);
+bool ourcrossing(const xcb_generic_event_t *ev);
+void lowlatency(void);
+void manage(xcb_window_t *wins, const int *desks, int n);
+bool transienttype(const xcb_atom_t *types, unsigned int n);
+void prefaultstack(void);
+void monocle(const desktop *d, const monitor *m);
+int64_t mstime(void);
+#if METRICS
+void observe(histogram *h, long us);
+#endif
 client* prev_client(client *c, desktop *d);
+#if SNAPSHOT
+void publishsnapshot(void);
+#endif
+void reapchildren(void);
+#if READER
+void* reader(void *arg);
+void startreader(void);
+void stopreader(void);
+#endif
+xcb_generic_event_t* nextevent(bool queued);
+xcb_generic_event_t* waitevent(void);
+void record(int kind, const void *data, uint32_t len);
+void recordatom(xcb_atom_t atom);
+void recordevent(const xcb_generic_event_t *ev);
+void recordproperty(xcb_window_t win, xcb_atom_t prop);
+void* recordreply(void *reply);
+void holdrecord(void);
+int nextrecord(void);
+int replay(const char *file);
 void removeclient(client *c, desktop *d, const monitor *m, bool delete);
 void removeclientfromlist(client *c, desktop *d);
+bool restorestate(int fd);
+int savestate(void);
+#if MENU
+void drawmenu(Menu *m);
+void fitmenu(Menu *m);
+void layoutmenu(Menu *m);
+void menupixmaps(Menu *m);
+void flipmenu(Menu *m, int page);
+int menucell(Menu *m, int x, int y);
+void menuclick(xcb_button_press_event_t *ev);
+void menukey(xcb_keysym_t keysym);
+void menuspiral(int cols, int rows, int *cells);
+void rendermenu(Menu *m);
+void selectmenucell(Menu *m, int cell);
+#endif
+#if MENU_SEARCH
+void drawsearch(void);
+void pathindexbuilt(pid_t pid);
+bool pathindexfile(void);
+bool searchkey(xcb_keysym_t keysym);
+void searchpathindex(bool refine);
+void updatepathindex(void);
+#endif
 void resizeclientbottom(const int size, client **c, desktop *d, monitor *m);
 void resizeclientleft(const int size, client **c, desktop *d, monitor *m);
 void resizeclientright(const int size, client **c, desktop *d, monitor *m);
 void resizeclienttop(const int size, client **c, desktop *d, monitor *m);
+#if AUDIT
+void auditbegin(void);
+int auditcmp(const void *a, const void *b);
+void auditend(const char *func, int line);
+void* auditendp(const char *func, int line, void *reply);
+uint8_t auditend8(const char *func, int line, uint8_t reply);
+void auditreport(void);
+#endif
+void checkreload(void);
+int decodetrace(const char *file);
+void dumptrace(void);
+const char* eventname(int type, char *buf, size_t size);
+xcb_window_t eventwindow(const xcb_generic_event_t *ev);
+void commit(void);
 void retile(desktop *d, const monitor *m);
+const char* resolvecmd(const char *name);
+void runevent(xcb_generic_event_t *ev);
+void setupevents(void);
 void setclientborders(client *c, const desktop *d, const monitor *m);
+int soak(int n);
+void soaksync(void);
+#if BAR
+void setupbar(void);
+#endif
+#if MENU_SEARCH
+void setuppathindex(void);
+#endif
 int setuprandr(void);
+#if SNAPSHOT
+void setupsnapshot(void);
+#endif
+void runsignals(void);
 void sigchld();
-void text_draw (xcb_gcontext_t gc, xcb_window_t window, int16_t x1, int16_t y1, const char *label);
+void sigcrash(int sig);
+void sigwake(int sig);
+void splitwindows(client *n, client *o, const desktop *d, const monitor *m);
+#if RESERVE_SLOTS
+typedef struct slot slot;
+slot* takeslot(pid_t pid, const char *id, int idlen);
+#endif
+void timephase(const char *phase);
+void tracepoint(int point, xcb_window_t win, int event, int64_t start, uint32_t arg);
+void trackchild(pid_t pid, void (*done)(pid_t pid));
+void text_draw (xcb_gcontext_t gc, xcb_drawable_t drawable, int16_t x1, int16_t y1, const char *label);
 void tilenew(client *n, client *o, desktop *d, const monitor *m);
 void tileremove(client *dead, desktop *d, const monitor *m);
 void unmapnotify(xcb_generic_event_t *e);
+#if BAR
+void updatebars(void);
+#endif
 #if PRETTY_PRINT
 void updatedir();
 void updatemode();
-void updatetitle(client *c);
 void updatews();
 #endif
+#if STATUS
+const char* interntitle(const char *str, int len);
+void releasetitle(const char *str);
+void requesttitle(client *c);
+bool titleshown(const client *c);
+int titletimeout(void);
+bool updatetitles(bool wait);
+bool titlespending(void);
+#endif
+uint64_t fnv(uint64_t h, const void *data, size_t len);
+int64_t ustime(void);
+int bench(int n);
+int benchcheck(const char *after);
+void benchgeom(void);
+uint32_t xcbid(void);
+void xcbconfigure(xcb_window_t win, uint16_t mask, const void *values);
+void xcbmap(xcb_window_t win);
+void xcbunmap(xcb_window_t win);
+void xcbproperty(uint8_t mode, xcb_window_t win, xcb_atom_t prop, xcb_atom_t type, uint8_t format, uint32_t len, const void *data);
+void xcbfocus(uint8_t revert, xcb_window_t win, xcb_timestamp_t time);
+void xcbattributes(xcb_window_t win, uint32_t mask, const void *values);
+void xcbgrabkey(uint8_t owner, xcb_window_t win, uint16_t mods, xcb_keycode_t key, uint8_t pmode, uint8_t kmode);
+void xcbungrabkey(xcb_keycode_t key, xcb_window_t win, uint16_t mods);
+void xcbgrabbutton(uint8_t owner, xcb_window_t win, uint16_t mask, uint8_t pmode, uint8_t kmode, xcb_window_t confine, xcb_cursor_t cursor, uint8_t button, uint16_t mods);
+void xcbungrabbutton(uint8_t button, xcb_window_t win, uint16_t mods);
+void xcbpixmap(uint8_t depth, xcb_pixmap_t pmap, xcb_drawable_t drawable, uint16_t w, uint16_t h);
+void xcbfreepixmap(xcb_pixmap_t pmap);
+void xcbgc(xcb_gcontext_t gc, xcb_drawable_t drawable, uint32_t mask, const void *values);
+void xcbchangegc(xcb_gcontext_t gc, uint32_t mask, const void *values);
+void xcbfreegc(xcb_gcontext_t gc);
+void xcbfill(xcb_drawable_t drawable, xcb_gcontext_t gc, uint32_t n, const xcb_rectangle_t *rects);
+void xcbcopy(xcb_drawable_t src, xcb_drawable_t dst, xcb_gcontext_t gc, int16_t sx, int16_t sy, int16_t dx, int16_t dy, uint16_t w, uint16_t h);
+void xcbtext(uint8_t len, xcb_drawable_t drawable, xcb_gcontext_t gc, int16_t x, int16_t y, const char *str);
+void xcbsend(uint8_t propagate, xcb_window_t win, uint32_t mask, const char *event);
+void xcbflush(void);
+uint32_t fakeid(void);
+void fakeconfigure(xcb_window_t win, uint16_t mask, const void *values);
+void fakemap(xcb_window_t win);
+void fakeunmap(xcb_window_t win);
+void fakeproperty(uint8_t mode, xcb_window_t win, xcb_atom_t prop, xcb_atom_t type, uint8_t format, uint32_t len, const void *data);
+void fakefocus(uint8_t revert, xcb_window_t win, xcb_timestamp_t time);
+void fakeattributes(xcb_window_t win, uint32_t mask, const void *values);
+void fakegrabkey(uint8_t owner, xcb_window_t win, uint16_t mods, xcb_keycode_t key, uint8_t pmode, uint8_t kmode);
+void fakeungrabkey(xcb_keycode_t key, xcb_window_t win, uint16_t mods);
+void fakegrabbutton(uint8_t owner, xcb_window_t win, uint16_t mask, uint8_t pmode, uint8_t kmode, xcb_window_t confine, xcb_cursor_t cursor, uint8_t button, uint16_t mods);
+void fakeungrabbutton(uint8_t button, xcb_window_t win, uint16_t mods);
+void fakepixmap(uint8_t depth, xcb_pixmap_t pmap, xcb_drawable_t drawable, uint16_t w, uint16_t h);
+void fakefreepixmap(xcb_pixmap_t pmap);
+void fakegc(xcb_gcontext_t gc, xcb_drawable_t drawable, uint32_t mask, const void *values);
+void fakechangegc(xcb_gcontext_t gc, uint32_t mask, const void *values);
+void fakefreegc(xcb_gcontext_t gc);
+void fakefill(xcb_drawable_t drawable, xcb_gcontext_t gc, uint32_t n, const xcb_rectangle_t *rects);
+void fakecopy(xcb_drawable_t src, xcb_drawable_t dst, xcb_gcontext_t gc, int16_t sx, int16_t sy, int16_t dx, int16_t dy, uint16_t w, uint16_t h);
+void faketext(uint8_t len, xcb_drawable_t drawable, xcb_gcontext_t gc, int16_t x, int16_t y, const char *str);
+void fakesend(uint8_t propagate, xcb_window_t win, uint32_t mask, const char *event);
+void fakeflush(void);
+fakewin* fakewindow(xcb_window_t win);
+xcb_atom_t fakeatom(const char *name);
+void fakesetup(uint16_t width, uint16_t height);
+void memusage(long *rss, size_t *heap);
+uint32_t lookupid(idpair **map, int *size, int *n, uint32_t from, uint32_t to);
 client *wintoclient(xcb_window_t w);
 monitor *wintomon(xcb_window_t w);
+#if METRICS
+void writemetrics(void);
+#endif
+
+/* counters exposed to the outside
+ *
+ * titlessuppressed - title changes that were not fetched or not shown
+ * mapbursts        - batches of new windows handled by manage(), by size:
+ *                    1, 2-3, 4-7, 8-15 and 16 or more
+ * mapburstmax      - the most windows managed at once
+ * latency          - what lowlatency() got, LATENCY_ flags, 0 without -l
+ *
+ * with METRICS, dumped by writemetrics()
+ * handlers         - time spent per event type, and in commit()
+ * replywaits       - replies and request checks waited for, see XREPLY
+ * noops            - requests writemetrics() sent to count the others
+ * flushes          - explicit flushes of the request buffer
+ * retiles          - desktops retiled
+ * configures       - windows moved or resized
+ * allocs           - calls to malloc_safe()
+ * crossingsignored - EnterNotify caused by 4wm moving windows, not the pointer
+ * queued           - time events waited in the ring of reader()
+ * readerstalls     - times reader() found the ring full and backed off
+ */
+typedef struct {
+    unsigned long titlessuppressed;
+    unsigned long mapbursts[MAPBURST_BUCKETS], mapburstmax;
+    unsigned long latency;
+    #if METRICS
+    histogram handlers[XCB_NO_OPERATION + 1];
+    unsigned long replywaits, noops, flushes, retiles, configures, allocs, crossingsignored;
+    #if READER
+    histogram queued;
+    _Atomic unsigned long readerstalls;     // counted by reader()
+    #endif
+    #endif
+} wmstats;
 
 // variables
 bool running = true;
@@ -205,17 +983,136 @@ unsigned int numlockmask = 0, win_unfocus, win_focus, win_outer, win_urgent, win
 xcb_connection_t *dis;
 xcb_screen_t *screen;
 xcb_atom_t wmatoms[WM_COUNT], netatoms[NET_COUNT];
+char *wmatomnames[WM_COUNT]   = { "WM_PROTOCOLS", "WM_DELETE_WINDOW", "WM_STATE" };
+char *netatomnames[NET_COUNT] = { "_NET_SUPPORTED", "_NET_WM_STATE_FULLSCREEN", "_NET_WM_STATE", "_NET_ACTIVE_WINDOW", "_NET_WM_NAME" };
 static desktop desktops[DESKTOPS];
 monitor *mons = NULL, *selmon = NULL;
 xcb_ewmh_connection_t *ewmh;
+wmstats stats;
+proc *procs = NULL;                 // children launched and not yet exited
+struct pollfd *pollfds = NULL;      // see POLL_X, a pidfd per proc at the end
+int nprocs = 0;
+bool usepidfd = false;
+pid_t reapedpids[REAPED_PIDS];      // a ring, written by sigchld() without pidfds
+_Atomic unsigned int reapedhead = 0;
+unsigned int reapedtail = 0;        // where reapchildren() looked last
+xcb_key_symbols_t *keysyms = NULL;  // fetched once, refreshed on mapping changes
+bool timing = false;                // -T, print how long setup took
+bool restarting = false;            // set by restart(), main() execs 4wm again
+int statefd = -1;                   // -R, the layout of the 4wm before us
+const char *argv0 = "4wm";          // how 4wm was run, to run it again
+xcb_visualtype_t *visual = NULL;    // the root visual, for computing pixels
+char xdefaults[PATH_MAX];           // the resource file colors are read from
+bool reloadpending = false;          // SIGHUP, see checkreload()
+int sigwritefd = -1;                // the end of the POLL_SIGNAL pipe sigwake() writes to
+bool tracing = false;               // -t or toggletrace(), see TRACE
+tracerec tracering[TRACE_SIZE];
+_Atomic uint64_t tracehead = 0;
+char tracepath[PATH_MAX];           // where dumptrace() writes, set in setup()
+FILE *recordfile = NULL;            // -r, where recordevent() writes
+int64_t recordstart;                // 0 until setup() is done, nothing is recorded before
+replayer replaying;                 // -p, f is NULL otherwise
+xcb_atom_t recorded[256];           // atoms whose names are in the recording
+int nrecorded = 0;
+#if AUDIT
+auditsite auditsites[AUDIT_SITES];
+int nauditsites = 0, curhandler = HANDLER_NONE;
+int64_t auditstart;
+#endif
+pool clientpool = POOL(client);
+geomstore geoms[DESKTOPS];          // see geomadd()
+arena scratch;                      // cleared after every event and commit
+seqspan layoutspans[LAYOUT_SPANS];  // see layoutrequest()
+int nlayoutspans = 0, oldspans = 0;    // spans from oldspans on are kept
+bool layoutopen = false;
+#if READER
+queuedevent ring[READER_RING];      // see reader()
+_Atomic unsigned int ringhead = 0, ringtail = 0;
+pthread_t readerthread;
+int readerfd = -1;                  // eventfd reader() wakes the main thread with, -1 without a reader
+#endif
+xcb_window_t *mapqueue = NULL;      // windows that asked to be mapped this batch
+int nmapqueue = 0, maxmapqueue = 0;
+cmdpath *cmdpaths = NULL;
+extern char **environ;
+#if LAYOUTS
+layoutslot *pending[DESKTOPS];      // tiles of an applied layout still empty
+int npending[DESKTOPS];
+#endif
 #if MENU
-Menu *menus = NULL;
+Menu *menus = NULL, *openmenu = NULL;
 Xresources xres;
+pool entrypool = POOL(Menu_Entry);
+#endif
+#if STATUS
+titlestr *titles[TITLE_BUCKETS];
+#endif
+#if MENU_SEARCH
+pathindex pindex;
 #endif
 #if PRETTY_PRINT
 pid_t pid;
 pp_data pp;
 #endif
+#if SNAPSHOT
+snapshot *snap = NULL;
+char snappath[256];
+#endif
+#if BAR
+baratlas atlas;
+#endif
+#if RESERVE_SLOTS
+slot slots[RESERVE_SLOTS];
+#endif
+
+const backend xcbbackend = {
+    .id = xcbid,
+    .configure = xcbconfigure,
+    .map = xcbmap,
+    .unmap = xcbunmap,
+    .property = xcbproperty,
+    .focus = xcbfocus,
+    .attributes = xcbattributes,
+    .grabkey = xcbgrabkey,
+    .ungrabkey = xcbungrabkey,
+    .grabbutton = xcbgrabbutton,
+    .ungrabbutton = xcbungrabbutton,
+    .pixmap = xcbpixmap,
+    .freepixmap = xcbfreepixmap,
+    .gc = xcbgc,
+    .changegc = xcbchangegc,
+    .freegc = xcbfreegc,
+    .fill = xcbfill,
+    .copy = xcbcopy,
+    .text = xcbtext,
+    .send = xcbsend,
+    .flush = xcbflush,
+};
+const backend fakebackend = {
+    .id = fakeid,
+    .configure = fakeconfigure,
+    .map = fakemap,
+    .unmap = fakeunmap,
+    .property = fakeproperty,
+    .focus = fakefocus,
+    .attributes = fakeattributes,
+    .grabkey = fakegrabkey,
+    .ungrabkey = fakeungrabkey,
+    .grabbutton = fakegrabbutton,
+    .ungrabbutton = fakeungrabbutton,
+    .pixmap = fakepixmap,
+    .freepixmap = fakefreepixmap,
+    .gc = fakegc,
+    .changegc = fakechangegc,
+    .freegc = fakefreegc,
+    .fill = fakefill,
+    .copy = fakecopy,
+    .text = faketext,
+    .send = fakesend,
+    .flush = fakeflush,
+};
+const backend *xb = &xcbbackend;
+fakeserver fake;
 
 // events array on receival of a new event, call the appropriate function to handle it
 void (*events[XCB_NO_OPERATION])(xcb_generic_event_t *e);
@@ -271,7 +1168,9 @@ inline void xcb_move_resize(client *w, const desktop *d, const monitor *m) {
     DEBUGP("xcb_move_resize: x: %d, y: %d, w: %d, h: %d\n", w->x, w->y, w->w, w->h);
     unsigned int pos[4] = { w->x, w->y, w->w, w->h };
     setclientborders(w, d, m);
-    xcb_configure_window(dis, w->win, XCB_MOVE_RESIZE, pos);
+    xb->configure(w->win, XCB_MOVE_RESIZE, pos);
+    geomset(d, w, pos[0], pos[1], pos[2], pos[3]);
+    COUNT(configures);
 }
 
 inline void xcb_move_resize_monocle(client *w, const desktop *d, const monitor *m) {
@@ -281,45 +1180,50 @@ inline void xcb_move_resize_monocle(client *w, const desktop *d, const monitor *
                             d->mode == VIDEO ? m->w : (m->w - 2*d->gap), 
                             d->mode == VIDEO ? (m->h + ((m->haspanel && !TOP_PANEL) ? PANEL_HEIGHT:0)) : (m->h - 2*d->gap)};
     setclientborders(w, d, m);
-    xcb_configure_window(dis, w->win, XCB_MOVE_RESIZE, pos);
+    xb->configure(w->win, XCB_MOVE_RESIZE, pos);
+    geomset(d, w, pos[0], pos[1], pos[2], pos[3]);
+    COUNT(configures);
 }
 
 // wrapper to move window
 inline void xcb_move(xcb_window_t win, int x, int y) {
     unsigned int pos[2] = { x, y };
-    xcb_configure_window(dis, win, XCB_MOVE, pos);
+    xb->configure(win, XCB_MOVE, pos);
 }
 
 // wrapper to resize window
 inline void xcb_resize(xcb_window_t win, int w, int h) {
     unsigned int pos[2] = { w, h };
-    xcb_configure_window(dis, win, XCB_RESIZE, pos);
+    xb->configure(win, XCB_RESIZE, pos);
 }
 
 // wrapper to lower window
 inline void xcb_lower_window(xcb_window_t win) {
     unsigned int arg[1] = { XCB_STACK_MODE_BELOW };
-    xcb_configure_window(dis, win, XCB_CONFIG_WINDOW_STACK_MODE, arg);
+    xb->configure(win, XCB_CONFIG_WINDOW_STACK_MODE, arg);
 }
 
 // wrapper to raise window
 inline void xcb_raise_window(xcb_window_t win) {
     unsigned int arg[1] = { XCB_STACK_MODE_ABOVE };
-    xcb_configure_window(dis, win, XCB_CONFIG_WINDOW_STACK_MODE, arg);
+    xb->configure(win, XCB_CONFIG_WINDOW_STACK_MODE, arg);
+}
+
+// wrapper to request atoms using xcb, the replies are read by xcb_get_atoms()
+void xcb_intern_atoms(char **names, xcb_intern_atom_cookie_t *cookies, unsigned int count) {
+    for (unsigned int i = 0; i < count; i++) cookies[i] = xcb_intern_atom(dis, 0, strlen(names[i]), names[i]);
 }
 
 // wrapper to get atoms using xcb
-void xcb_get_atoms(char **names, xcb_atom_t *atoms, unsigned int count) {
-    xcb_intern_atom_cookie_t cookies[count];
+void xcb_get_atoms(char **names, xcb_intern_atom_cookie_t *cookies, xcb_atom_t *atoms, unsigned int count) {
     xcb_intern_atom_reply_t  *reply;
 
-    for (unsigned int i = 0; i < count; i++) cookies[i] = xcb_intern_atom(dis, 0, strlen(names[i]), names[i]);
     for (unsigned int i = 0; i < count; i++) {
-        reply = xcb_intern_atom_reply(dis, cookies[i], NULL); // TODO: Handle error
+        reply = XREPLY(xcb_intern_atom_reply(dis, cookies[i], NULL)); // TODO: Handle error
         if (reply) {
             DEBUGP("%s : %d\n", names[i], reply->atom);
             atoms[i] = reply->atom; free(reply);
-        } else puts("WARN: 4wm failed to register %s atom.\nThings might not work right.");
+        } else fprintf(stderr, "WARN: 4wm failed to register %s atom.\nThings might not work right.\n", names[i]);
     }
 }
 
@@ -327,11 +1231,11 @@ void xcb_get_atoms(char **names, xcb_atom_t *atoms, unsigned int count) {
 void xcb_get_attributes(xcb_window_t *windows, xcb_get_window_attributes_reply_t **reply, unsigned int count) {
     xcb_get_window_attributes_cookie_t cookies[count];
     for (unsigned int i = 0; i < count; i++) cookies[i] = xcb_get_window_attributes(dis, windows[i]);
-    for (unsigned int i = 0; i < count; i++) reply[i]   = xcb_get_window_attributes_reply(dis, cookies[i], NULL); // TODO: Handle error
+    for (unsigned int i = 0; i < count; i++) reply[i]   = XREPLY(xcb_get_window_attributes_reply(dis, cookies[i], NULL)); // TODO: Handle error
 }
 
 // retieve RGB color from hex (think of html)
-unsigned int xcb_get_colorpixel(char *hex) {
+unsigned int xcb_get_colorpixel(const char *hex) {
     char strgroups[3][3]  = {{hex[1], hex[2], '\0'}, {hex[3], hex[4], '\0'}, {hex[5], hex[6], '\0'}};
     unsigned int rgb16[3] = {(strtol(strgroups[0], NULL, 16)), (strtol(strgroups[1], NULL, 16)), (strtol(strgroups[2], NULL, 16))};
     return (rgb16[0] << 16) + (rgb16[1] << 8) + rgb16[2];
@@ -339,26 +1243,15 @@ unsigned int xcb_get_colorpixel(char *hex) {
 
 // wrapper to get xcb keycodes from keysymbol
 xcb_keycode_t* xcb_get_keycodes(xcb_keysym_t keysym) {
-    xcb_key_symbols_t *keysyms;
-    xcb_keycode_t     *keycode;
-
-    if (!(keysyms = xcb_key_symbols_alloc(dis))) return NULL;
-        keycode = xcb_key_symbols_get_keycode(keysyms, keysym);
-    xcb_key_symbols_free(keysyms);
-
-    return keycode;
+    return xcb_key_symbols_get_keycode(keysyms, keysym);
 }
 
-// wrapper to get xcb keysymbol from keycode
-xcb_keysym_t xcb_get_keysym(xcb_keycode_t keycode) {
-    xcb_key_symbols_t *keysyms;
-    xcb_keysym_t       keysym;
-
-    if (!(keysyms = xcb_key_symbols_alloc(dis))) return 0;
-    keysym = xcb_key_symbols_get_keysym(keysyms, keycode, 0);
-    xcb_key_symbols_free(keysyms);
-
-    return keysym;
+// wrapper to get xcb keysymbol from keycode, col 1 is with Shift. a replay
+// has no keymap, it uses the keysyms in the recording
+xcb_keysym_t xcb_get_keysym(xcb_keycode_t keycode, int col) {
+    if (replaying.f)
+        return replaying.keysyms[keycode][col];
+    return xcb_key_symbols_get_keysym(keysyms, keycode, col);
 }
 
 // get screen of display
@@ -369,19 +1262,245 @@ xcb_screen_t *xcb_screen_of_display(xcb_connection_t *con, int screen) {
     return NULL;
 }
 
-// check if other wm exists
-int xcb_checkotherwm(void) {
-    xcb_generic_error_t *error;
+// select the root window events, fails if another wm already has them
+xcb_void_cookie_t xcb_selectroot(void) {
     unsigned int values[1] = {XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT|XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY|
                               XCB_EVENT_MASK_PROPERTY_CHANGE|XCB_EVENT_MASK_BUTTON_PRESS};
-    error = xcb_request_check(dis, xcb_change_window_attributes_checked(dis, screen->root, XCB_CW_EVENT_MASK, values));
-    xcb_flush(dis);
-    if (error) return 1;
+    return xcb_change_window_attributes_checked(dis, screen->root, XCB_CW_EVENT_MASK, values);
+}
+
+// check if other wm exists
+int xcb_checkotherwm(xcb_void_cookie_t cookie) {
+    xcb_generic_error_t *error = XREPLY(xcb_request_check(dis, cookie));
+    if (error) {
+        free(error);
+        return 1;
+    }
     return 0;
 }
 
 
 
+// the backend for a real X server, see backend
+uint32_t xcbid(void) { return xcb_generate_id(dis); }
+void xcbconfigure(xcb_window_t win, uint16_t mask, const void *values) { layoutrequest(xcb_configure_window(dis, win, mask, values).sequence); }
+void xcbmap(xcb_window_t win) { layoutrequest(xcb_map_window(dis, win).sequence); }
+void xcbunmap(xcb_window_t win) { layoutrequest(xcb_unmap_window(dis, win).sequence); }
+void xcbproperty(uint8_t mode, xcb_window_t win, xcb_atom_t prop, xcb_atom_t type, uint8_t format, uint32_t len, const void *data) { xcb_change_property(dis, mode, win, prop, type, format, len, data); }
+void xcbfocus(uint8_t revert, xcb_window_t win, xcb_timestamp_t time) { xcb_set_input_focus(dis, revert, win, time); }
+void xcbattributes(xcb_window_t win, uint32_t mask, const void *values) { xcb_change_window_attributes(dis, win, mask, values); }
+void xcbgrabkey(uint8_t owner, xcb_window_t win, uint16_t mods, xcb_keycode_t key, uint8_t pmode, uint8_t kmode) { xcb_grab_key(dis, owner, win, mods, key, pmode, kmode); }
+void xcbungrabkey(xcb_keycode_t key, xcb_window_t win, uint16_t mods) { xcb_ungrab_key(dis, key, win, mods); }
+void xcbgrabbutton(uint8_t owner, xcb_window_t win, uint16_t mask, uint8_t pmode, uint8_t kmode, xcb_window_t confine, xcb_cursor_t cursor, uint8_t button, uint16_t mods) { xcb_grab_button(dis, owner, win, mask, pmode, kmode, confine, cursor, button, mods); }
+void xcbungrabbutton(uint8_t button, xcb_window_t win, uint16_t mods) { xcb_ungrab_button(dis, button, win, mods); }
+void xcbpixmap(uint8_t depth, xcb_pixmap_t pmap, xcb_drawable_t drawable, uint16_t w, uint16_t h) { xcb_create_pixmap(dis, depth, pmap, drawable, w, h); }
+void xcbfreepixmap(xcb_pixmap_t pmap) { xcb_free_pixmap(dis, pmap); }
+void xcbgc(xcb_gcontext_t gc, xcb_drawable_t drawable, uint32_t mask, const void *values) { xcb_create_gc(dis, gc, drawable, mask, values); }
+void xcbchangegc(xcb_gcontext_t gc, uint32_t mask, const void *values) { xcb_change_gc(dis, gc, mask, values); }
+void xcbfreegc(xcb_gcontext_t gc) { xcb_free_gc(dis, gc); }
+void xcbfill(xcb_drawable_t drawable, xcb_gcontext_t gc, uint32_t n, const xcb_rectangle_t *rects) { xcb_poly_fill_rectangle(dis, drawable, gc, n, rects); }
+void xcbcopy(xcb_drawable_t src, xcb_drawable_t dst, xcb_gcontext_t gc, int16_t sx, int16_t sy, int16_t dx, int16_t dy, uint16_t w, uint16_t h) { xcb_copy_area(dis, src, dst, gc, sx, sy, dx, dy, w, h); }
+void xcbtext(uint8_t len, xcb_drawable_t drawable, xcb_gcontext_t gc, int16_t x, int16_t y, const char *str) { xcb_image_text_8(dis, len, drawable, gc, x, y, str); }
+void xcbsend(uint8_t propagate, xcb_window_t win, uint32_t mask, const char *event) { xcb_send_event(dis, propagate, win, mask, event); }
+void xcbflush(void) { xcb_flush(dis); }
+
+// the fake backend, see fakeserver
+uint32_t fakeid(void) {
+    return ++fake.nextid;
+}
+
+void fakeconfigure(xcb_window_t win, uint16_t mask, const void *values) {
+    const uint32_t *v = values;
+    fakewin *w = fakewindow(win);
+
+    fake.requests++;
+    fake.configures++;
+    if (mask & XCB_CONFIG_WINDOW_X)            w->x = (int32_t)*v++;
+    if (mask & XCB_CONFIG_WINDOW_Y)            w->y = (int32_t)*v++;
+    if (mask & XCB_CONFIG_WINDOW_WIDTH)        w->w = *v++;
+    if (mask & XCB_CONFIG_WINDOW_HEIGHT)       w->h = *v++;
+    if (mask & XCB_CONFIG_WINDOW_BORDER_WIDTH) w->border = *v++;
+    if (mask & XCB_CONFIG_WINDOW_SIBLING)      v++;
+    if (mask & XCB_CONFIG_WINDOW_STACK_MODE)
+        w->stack += *v == XCB_STACK_MODE_ABOVE ? 1 : *v == XCB_STACK_MODE_BELOW ? -1 : 0;
+}
+
+void fakemap(xcb_window_t win) {
+    fake.requests++;
+    fake.maps++;
+    fakewindow(win)->mapped = true;
+}
+
+void fakeunmap(xcb_window_t win) {
+    fake.requests++;
+    fake.maps++;
+    fakewindow(win)->mapped = false;
+}
+
+void fakeproperty(uint8_t mode, xcb_window_t win, xcb_atom_t prop, xcb_atom_t type, uint8_t format, uint32_t len, const void *data) {
+    (void)mode; (void)type; (void)format;
+    fake.requests++;
+    fake.properties++;
+    if (prop == XCB_ATOM_WM_TRANSIENT_FOR && len)
+        fakewindow(win)->transient = *(const xcb_window_t *)data;
+    else if (prop == XCB_ATOM_WM_CLASS) { // the instance, then the class
+        const char *instance = memchr(data, '\0', len);
+        fakewin *w = fakewindow(win);
+        if (instance)
+            snprintf(w->class, sizeof(w->class), "%.*s", (int)(len - (instance + 1 - (const char *)data)), instance + 1);
+    } else if (ewmh && prop == ewmh->_NET_WM_WINDOW_TYPE) {
+        fakewin *w = fakewindow(win);
+        w->ntypes = len < LENGTH(w->types) ? len : LENGTH(w->types);
+        memcpy(w->types, data, w->ntypes * sizeof(xcb_atom_t));
+    }
+}
+
+void fakefocus(uint8_t revert, xcb_window_t win, xcb_timestamp_t time) {
+    (void)revert; (void)time;
+    fake.requests++;
+    fake.focuses++;
+    fake.focus = win;
+}
+
+void fakeattributes(xcb_window_t win, uint32_t mask, const void *values) {
+    (void)win; (void)mask; (void)values;
+    fake.requests++;
+}
+
+void fakegrabkey(uint8_t owner, xcb_window_t win, uint16_t mods, xcb_keycode_t key, uint8_t pmode, uint8_t kmode) {
+    (void)owner; (void)win; (void)mods; (void)key; (void)pmode; (void)kmode;
+    fake.requests++;
+    fake.grabs++;
+}
+
+void fakeungrabkey(xcb_keycode_t key, xcb_window_t win, uint16_t mods) {
+    (void)key; (void)win; (void)mods;
+    fake.requests++;
+    fake.grabs++;
+}
+
+void fakegrabbutton(uint8_t owner, xcb_window_t win, uint16_t mask, uint8_t pmode, uint8_t kmode, xcb_window_t confine, xcb_cursor_t cursor, uint8_t button, uint16_t mods) {
+    (void)owner; (void)win; (void)mask; (void)pmode; (void)kmode; (void)confine; (void)cursor; (void)button; (void)mods;
+    fake.requests++;
+    fake.grabs++;
+}
+
+void fakeungrabbutton(uint8_t button, xcb_window_t win, uint16_t mods) {
+    (void)button; (void)win; (void)mods;
+    fake.requests++;
+    fake.grabs++;
+}
+
+void fakepixmap(uint8_t depth, xcb_pixmap_t pmap, xcb_drawable_t drawable, uint16_t w, uint16_t h) {
+    (void)depth; (void)pmap; (void)drawable; (void)w; (void)h;
+    fake.requests++;
+    fake.draws++;
+}
+
+void fakefreepixmap(xcb_pixmap_t pmap) {
+    (void)pmap;
+    fake.requests++;
+    fake.draws++;
+}
+
+void fakegc(xcb_gcontext_t gc, xcb_drawable_t drawable, uint32_t mask, const void *values) {
+    (void)gc; (void)drawable; (void)mask; (void)values;
+    fake.requests++;
+    fake.draws++;
+}
+
+void fakechangegc(xcb_gcontext_t gc, uint32_t mask, const void *values) {
+    (void)gc; (void)mask; (void)values;
+    fake.requests++;
+    fake.draws++;
+}
+
+void fakefreegc(xcb_gcontext_t gc) {
+    (void)gc;
+    fake.requests++;
+    fake.draws++;
+}
+
+void fakefill(xcb_drawable_t drawable, xcb_gcontext_t gc, uint32_t n, const xcb_rectangle_t *rects) {
+    (void)drawable; (void)gc; (void)n; (void)rects;
+    fake.requests++;
+    fake.draws++;
+}
+
+void fakecopy(xcb_drawable_t src, xcb_drawable_t dst, xcb_gcontext_t gc, int16_t sx, int16_t sy, int16_t dx, int16_t dy, uint16_t w, uint16_t h) {
+    (void)src; (void)dst; (void)gc; (void)sx; (void)sy; (void)dx; (void)dy; (void)w; (void)h;
+    fake.requests++;
+    fake.draws++;
+}
+
+void faketext(uint8_t len, xcb_drawable_t drawable, xcb_gcontext_t gc, int16_t x, int16_t y, const char *str) {
+    (void)len; (void)drawable; (void)gc; (void)x; (void)y; (void)str;
+    fake.requests++;
+    fake.draws++;
+}
+
+void fakesend(uint8_t propagate, xcb_window_t win, uint32_t mask, const char *event) {
+    (void)propagate; (void)win; (void)mask; (void)event;
+    fake.requests++;
+}
+
+void fakeflush(void) {
+}
+
+// the atom for a name, made on first use. the predefined ones keep their
+// values, recordings carry them as they are
+xcb_atom_t fakeatom(const char *name) {
+    static const char *predefined[] = { [XCB_ATOM_ATOM] = "ATOM", [XCB_ATOM_CARDINAL] = "CARDINAL",
+        [XCB_ATOM_STRING] = "STRING", [XCB_ATOM_WINDOW] = "WINDOW", [XCB_ATOM_WM_NAME] = "WM_NAME",
+        [XCB_ATOM_WM_CLASS] = "WM_CLASS", [XCB_ATOM_WM_TRANSIENT_FOR] = "WM_TRANSIENT_FOR" };
+    int i;
+
+    for (i = 0; i < (int)LENGTH(predefined); i++)
+        if (predefined[i] && !strcmp(predefined[i], name))
+            return i;
+    for (i = 0; i < fake.natoms && strncmp(fake.atoms[i], name, sizeof(fake.atoms[i])); i++);
+    if (i == fake.natoms) {
+        if (fake.natoms == fake.maxatoms) {
+            fake.maxatoms = fake.maxatoms ? 2 * fake.maxatoms : 64;
+            if (!(fake.atoms = realloc(fake.atoms, fake.maxatoms * sizeof(*fake.atoms))))
+                err(EXIT_FAILURE, "cannot allocate fake atoms");
+        }
+        strncpy(fake.atoms[fake.natoms++], name, sizeof(fake.atoms[i]));
+    }
+    return XCB_ATOM_WM_TRANSIENT_FOR + 1 + i;
+}
+
+// one screen of width by height with a monitor over all of it, on the fake
+// backend, for -b and -p
+void fakesetup(uint16_t width, uint16_t height) {
+    static xcb_screen_t fakescreen = { .root = 1, .root_depth = 24 };
+
+    xb = &fakebackend;
+    fakescreen.width_in_pixels = width;
+    fakescreen.height_in_pixels = height;
+    screen = &fakescreen;
+    fake.nextid = screen->root;
+    mons = selmon = createmon(0, 0, 0, screen->width_in_pixels, screen->height_in_pixels, 1);
+    nmons = 1;
+    for (unsigned int i=0; i<DESKTOPS; i++)
+        desktops[i] = (desktop){ .mode = DEFAULT_MODE, .direction = DEFAULT_DIRECTION, .showpanel = SHOW_PANEL, .gap = GAP, .count = 0, };
+}
+
+// the fake window for an id, made on first use
+fakewin* fakewindow(xcb_window_t win) {
+    int i = lookupid(&fake.ids, &fake.sids, &fake.nids, win, fake.nwins + 1) - 1;
+
+    if (i == fake.nwins) {
+        if (fake.nwins == fake.maxwins) {
+            fake.maxwins = fake.maxwins ? 2 * fake.maxwins : 64;
+            if (!(fake.wins = realloc(fake.wins, fake.maxwins * sizeof(fakewin))))
+                err(EXIT_FAILURE, "cannot allocate fake windows");
+        }
+        fake.wins[fake.nwins++] = (fakewin){ .id = win };
+    }
+    return &fake.wins[i];
+}
+
 void addclienttolist(client *c, desktop *d) {
     client *p;
     for(p = d->head; p && p->next; p = p->next);
@@ -393,6 +1512,7 @@ void addclienttolist(client *c, desktop *d) {
         d->current = c;
     }
     c->next = NULL;
+    geomadd(d, c);
 }
 
 //if fed a positive size the clients grow by h, if negative shrink
@@ -400,6 +1520,7 @@ void addclienttolist(client *c, desktop *d) {
 void adjustbyh(client **grow, client **shrink, const int size, desktop *d, const monitor *m) {
     for(int i = 0; grow[i]; i++) {
         grow[i]->hp += size;
+        geomtile(d, grow[i]);
 
         SETWINDOW(grow[i], d, m);
         xcb_move_resize(grow[i], d, m);
@@ -408,6 +1529,7 @@ void adjustbyh(client **grow, client **shrink, const int size, desktop *d, const
     for(int i = 0; shrink[i]; i++) {
         shrink[i]->yp += size;
         shrink[i]->hp -= size;
+        geomtile(d, shrink[i]);
 
         SETWINDOW(shrink[i], d, m);
         xcb_move_resize(shrink[i], d, m);
@@ -417,6 +1539,7 @@ void adjustbyh(client **grow, client **shrink, const int size, desktop *d, const
 void adjustbyw(client **grow, client **shrink, const int size, desktop *d, const monitor *m) {
     for(int i = 0; grow[i]; i++) {
         grow[i]->wp += size;
+        geomtile(d, grow[i]);
         
         SETWINDOW(grow[i], d, m);
         xcb_move_resize(grow[i], d, m);
@@ -425,6 +1548,7 @@ void adjustbyw(client **grow, client **shrink, const int size, desktop *d, const
     for(int i = 0; shrink[i]; i++) {
         shrink[i]->xp += size;
         shrink[i]->wp -= size;
+        geomtile(d, shrink[i]);
 
         SETWINDOW(shrink[i], d, m);
         xcb_move_resize(shrink[i], d, m);
@@ -434,43 +1558,384 @@ void adjustbyw(client **grow, client **shrink, const int size, desktop *d, const
 // create a new client and add the new window
 // window should notify of property change events
 client* addwindow(xcb_window_t w, desktop *d) {
-    client *c;
-    if (!(c = (client *)malloc_safe(sizeof(client)))) 
-        err(EXIT_FAILURE, "cannot allocate client");
+    client *c = poolget(&clientpool);
 
     addclienttolist(c, d);
 
     DEBUGP("addwindow: d->count = %d\n", d->count);
 
     unsigned int values[1] = { XCB_EVENT_MASK_PROPERTY_CHANGE|XCB_EVENT_MASK_ENTER_WINDOW };
-    xcb_change_window_attributes_checked(dis, (c->win = w), XCB_CW_EVENT_MASK, values);
+    xb->attributes((c->win = w), XCB_CW_EVENT_MASK, values);
     return c;
 }
 
-// on the press of a button check to see if there's a binded function to call 
-// TODO: if we make the mouse able to switch monitors we could eliminate a call
-//       to wintomon
-void buttonpress(xcb_generic_event_t *e) {
-    xcb_button_press_event_t *ev = (xcb_button_press_event_t*)e; 
-    monitor *m = wintomon(ev->event);
-    client *c = wintoclient(ev->event);
+// take over the windows that are already there when 4wm starts, those a
+// previous 4wm left behind say where they were in WM_STATE and
+// _NET_WM_DESKTOP, see cleanup(). they are managed as one burst. after a
+// restart it finds the windows that mapped while no wm was running
+void adopt(void) {
+    xcb_query_tree_reply_t *tree;
+    xcb_get_property_reply_t *state;
+    uint32_t desk;
+    int n, k = 0;
+
+    if (!(tree = XREPLY(xcb_query_tree_reply(dis, xcb_query_tree(dis, screen->root), NULL))))
+        return;
+    if (!(n = xcb_query_tree_children_length(tree))) {
+        free(tree);
+        return;
+    }
 
-    #if CLICK_TO_FOCUS 
-    if (ev->detail == XCB_BUTTON_INDEX_1) {
-        if (m && m != selmon) {
-            monitor *mold = selmon;
-            client *cold = desktops[selmon->curr_dtop].current;
-            selmon = m;
-            #if PRETTY_PRINT
-            updatews();
-            updatemode();
-            updatedir();
-            desktopinfo();
-            #endif
-            if (cold)
-                setclientborders(cold, &desktops[mold->curr_dtop], mold);
+    xcb_window_t *wins = xcb_query_tree_children(tree), adopted[n];
+    xcb_get_property_cookie_t statecookie[n], deskcookie[n];
+    xcb_get_window_attributes_reply_t *attr[n];
+    int desks[n];
+
+    for (int i = 0; i < n; i++) {
+        statecookie[i] = xcb_get_property(dis, 0, wins[i], wmatoms[WM_STATE], wmatoms[WM_STATE], 0, 2);
+        deskcookie[i]  = xcb_ewmh_get_wm_desktop_unchecked(ewmh, wins[i]);
+    }
+    xcb_get_attributes(wins, attr, n);
+
+    for (int i = 0; i < n; i++) {
+        bool iconic = false;
+        if ((state = XREPLY(xcb_get_property_reply(dis, statecookie[i], NULL)))) {
+            iconic = xcb_get_property_value_length(state) >= 4
+                  && *(uint32_t *)xcb_get_property_value(state) == XCB_ICCCM_WM_STATE_ICONIC;
+            free(state);
         }
-     
+        if (XREPLY(xcb_ewmh_get_wm_desktop_reply(ewmh, deskcookie[i], &desk, NULL)) != 1 || desk >= DESKTOPS)
+            desk = selmon->curr_dtop;
+        // unmapped windows are only taken if they were hidden by a wm, those
+        // restorestate() took already are left alone
+        if (attr[i] && !attr[i]->override_redirect && !wintoclient(wins[i])
+            && (attr[i]->map_state == XCB_MAP_STATE_VIEWABLE || iconic)) {
+            desks[k] = desk;
+            adopted[k++] = wins[i];
+        }
+        free(attr[i]);
+    }
+
+    DEBUGP("adopt: %d of %d windows\n", k, n);
+    if (k)
+        manage(adopted, desks, k);
+    free(tree);
+}
+
+#if LAYOUTS
+// arrange the tiles of the current desktop as the layout saved under the
+// name arg->com[0]. windows go to the tile of their class first, then to
+// any empty one, the rest split the last tile. it all is configured at
+// once, tiles left empty are filled by the windows that map next
+void applylayout(const Arg *arg) {
+    desktop *d = &desktops[selmon->curr_dtop];
+    layoutslot *slots;
+    client *c, *last = NULL;
+    int n, nc = 0, i, j, k;
+
+    if ((n = loadlayout(arg->com[0], &slots)) <= 0)
+        return;
+    for (c = d->head; c; c = c->next)
+        if (!ISFT(c)) nc++;
+
+    client *tiles[nc + 1];
+    char classes[nc + 1][64];
+    bool used[n], placed[nc + 1];
+    for (c = d->head, i = 0; c; c = c->next)
+        if (!ISFT(c)) tiles[i++] = c;
+    getclasses(tiles, nc, classes);
+    memset(used, 0, sizeof(used));
+    memset(placed, 0, sizeof(placed));
+
+    for (k = 0; k < 2; k++) // by class, then whatever is left
+        for (i = 0; i < nc; i++)
+            for (j = 0; j < n && !placed[i]; j++)
+                if (!used[j] && (k || !strcmp(classes[i], slots[j].class))) {
+                    tiles[i]->xp = slots[j].xp; tiles[i]->yp = slots[j].yp;
+                    tiles[i]->wp = slots[j].wp; tiles[i]->hp = slots[j].hp;
+                    geomtile(d, tiles[i]);
+                    used[j] = placed[i] = true;
+                    last = tiles[i];
+                }
+    for (i = 0; i < nc; i++)
+        if (!placed[i]) {
+            splitwindows(tiles[i], last, d, NULL);
+            last = tiles[i];
+        }
+
+    free(pending[selmon->curr_dtop]);
+    pending[selmon->curr_dtop] = slots;
+    for (i = 0, k = 0; i < n; i++)
+        if (!used[i])
+            slots[k++] = slots[i];
+    npending[selmon->curr_dtop] = k;
+    DEBUGP("applylayout: %s, %d tiles, %d empty\n", arg->com[0], n, k);
+
+    retile(d, selmon);
+    #if PRETTY_PRINT
+    desktopinfo();
+    #endif
+}
+#endif
+
+#if AUDIT
+void auditbegin(void) {
+    auditstart = ustime();
+}
+
+// charge the wait that began with auditbegin() to func:line in curhandler
+void auditend(const char *func, int line) {
+    long us = ustime() - auditstart;
+    int i;
+
+    COUNT(replywaits);
+    for (i = 0; i < nauditsites; i++)
+        if (auditsites[i].line == line && auditsites[i].handler == curhandler && auditsites[i].func == func)
+            break;
+    if (i == nauditsites) {
+        if (nauditsites == AUDIT_SITES)
+            return;
+        auditsites[nauditsites++] = (auditsite){ .func = func, .line = line, .handler = curhandler };
+    }
+    auditsites[i].count++;
+    auditsites[i].total += us;
+    if (us > auditsites[i].max)
+        auditsites[i].max = us;
+}
+
+void* auditendp(const char *func, int line, void *reply) {
+    auditend(func, line);
+    return reply;
+}
+
+uint8_t auditend8(const char *func, int line, uint8_t reply) {
+    auditend(func, line);
+    return reply;
+}
+
+int auditcmp(const void *a, const void *b) {
+    long x = ((const auditsite *)a)->total, y = ((const auditsite *)b)->total;
+    return (x < y) - (x > y);
+}
+
+// print every place 4wm waited for the server, the longest total wait first
+void auditreport(void) {
+    char name[16];
+
+    qsort(auditsites, nauditsites, sizeof(auditsite), auditcmp);
+    fprintf(stderr, "4wm: round trips, by time spent waiting\n%10s %8s %8s %8s  %-16s %s\n",
+            "total(us)", "count", "avg(us)", "max(us)", "handler", "site");
+    for (int i = 0; i < nauditsites; i++) {
+        const auditsite *a = &auditsites[i];
+        fprintf(stderr, "%10ld %8lu %8ld %8ld  %-16s %s:%d\n", a->total, a->count, a->total / (long)a->count,
+                a->max, eventname(a->handler, name, sizeof(name)), a->func, a->line);
+    }
+}
+#endif
+
+// 4wm -b, run the layout, focus and desktop code n times against the fake
+// backend, no X server is needed. each round opens BENCH_WINDOWS windows,
+// cycles focus through them, moves one to the next desktop, switches
+// desktop and back, and closes them. prints operations and requests per
+// second and the requests each kind of operation cost. the first round is
+// checked against the fake server, see benchcheck(), and fails -b
+int bench(int n) {
+    unsigned long ops = 0;
+    int64_t start;
+    int bad = 0;
+
+    fakesetup(1920, 1080);
+    start = ustime();
+    for (int i = 0; i < n; i++) {
+        desktop *d = &desktops[selmon->curr_dtop];
+        for (int j = 0; j < BENCH_WINDOWS; j++, ops++) {
+            client *c = addwindow(xb->id(), d);
+            tilenew(c, d->prevfocus, d, selmon);
+            grabbuttons(c);
+            focus(c, d, selmon);
+            if (!i) bad += benchcheck("add");
+        }
+        for (int j = 0; j < BENCH_WINDOWS; j++, ops += 2) {
+            next_win();
+            prev_win();
+        }
+        client_to_desktop(&(Arg){.i = (selmon->curr_dtop + 1) % DESKTOPS});
+        if (!i) bad += benchcheck("client_to_desktop");
+        rotate(&(Arg){.i = 1});
+        if (!i) bad += benchcheck("rotate");
+        rotate(&(Arg){.i = -1});
+        if (!i) bad += benchcheck("rotate back");
+        ops += 3;
+        for (int k = 0; k < DESKTOPS; k++) {
+            monitor *m;
+            for (m = mons; m && m->curr_dtop != k; m = m->next);
+            for ( ; desktops[k].head; ops++) {
+                removeclient(desktops[k].head, &desktops[k], m, false);
+                if (!i) bad += benchcheck("remove");
+            }
+        }
+        scratchreset();
+    }
+    long took = ustime() - start;
+
+    printf("4wm: %lu operations in %ldus, %.0f ops/s, %.0f requests/s\n", ops, took,
+           took ? ops * 1e6 / took : 0.0, took ? fake.requests * 1e6 / took : 0.0);
+    printf("4wm: %.1f requests per operation: configure %.1f map %.1f property %.1f focus %.1f grab %.1f draw %.1f\n",
+           ops ? (double)fake.requests / ops : 0.0, ops ? (double)fake.configures / ops : 0.0,
+           ops ? (double)fake.maps / ops : 0.0, ops ? (double)fake.properties / ops : 0.0,
+           ops ? (double)fake.focuses / ops : 0.0, ops ? (double)fake.grabs / ops : 0.0,
+           ops ? (double)fake.draws / ops : 0.0);
+    benchgeom();
+    if (bad)
+        warnx("%d differences between 4wm and the fake server", bad);
+    free(fake.wins);
+    free(fake.ids);
+    free(mons);
+    pooldestroy(&clientpool);
+    return bad ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// compare the fake server with what 4wm thinks after an operation of -b.
+// on the shown desktops the tiles must sit where their percentages put
+// them, floaters where they were moved, and focus is on the current
+// client of selmon. the geometry store must hold every tile as it is.
+// returns the differences, each is printed
+int benchcheck(const char *after) {
+    int bad = 0;
+
+    for (int i = 0; i < DESKTOPS; i++) {
+        const geomstore *g = &geoms[i];
+        for (client *c = desktops[i].head; c; c = c->next)
+            if (g->owner[c->slot] != c || g->xp0[c->slot] != c->xp || g->yp0[c->slot] != c->yp
+                || g->xp1[c->slot] != c->xp + c->wp || g->yp1[c->slot] != c->yp + c->hp) {
+                warnx("after %s: window %u has a stale tile in the geometry store", after, c->win);
+                bad++;
+            }
+    }
+
+    for (monitor *m = mons; m; m = m->next) {
+        desktop *d = &desktops[m->curr_dtop];
+        for (client *c = d->head; c && (d->mode == TILE || d->mode == FLOAT); c = c->next) {
+            client t = *c;
+            const fakewin *w = fakewindow(c->win);
+            if (!ISFT(c))
+                SETWINDOW(&t, d, m);
+            if (w->x != t.x || w->y != t.y || w->w != t.w || w->h != t.h) {
+                warnx("after %s: window %u is at %d,%d %dx%d, not %d,%d %dx%d", after, c->win,
+                      w->x, w->y, w->w, w->h, t.x, t.y, t.w, t.h);
+                bad++;
+            }
+        }
+        if (m == selmon && d->current && fake.focus != d->current->win) {
+            warnx("after %s: focus is on %u, not %u", after, fake.focus, d->current->win);
+            bad++;
+        }
+    }
+    return bad;
+}
+
+// time geomhit() against walking the client list for growing desktops
+// of tiled windows in a grid, queried at points spread over the screen
+void benchgeom(void) {
+    desktop *d = &desktops[0];
+    volatile uintptr_t sink = 0;
+    unsigned int seed = 1;
+    const int queries = 100000;
+
+    for (int n = 16; n <= 4096; n *= 4) {
+        int cols = 1;
+        while (cols * cols < n) cols++;
+        for (int i = 0; i < n; i++) {
+            client *c = poolget(&clientpool);
+            c->w = screen->width_in_pixels / cols;
+            c->h = screen->height_in_pixels / cols;
+            c->x = i % cols * c->w;
+            c->y = i / cols * c->h;
+            addclienttolist(c, d);
+        }
+        int64_t start = ustime();
+        for (int q = 0; q < queries; q++) {
+            seed = seed * 1103515245 + 12345;
+            sink += (uintptr_t)geomhit(d, seed % screen->width_in_pixels, (seed >> 16) % screen->height_in_pixels);
+        }
+        long hit = ustime() - start;
+        start = ustime();
+        for (int q = 0; q < queries; q++) {
+            int x, y;
+            seed = seed * 1103515245 + 12345;
+            x = seed % screen->width_in_pixels;
+            y = (seed >> 16) % screen->height_in_pixels;
+            client *c;
+            for (c = d->head; c && (ISFT(c) || !INRECT(x, y, c->x, c->y, c->w, c->h)); c = c->next);
+            sink += (uintptr_t)c;
+        }
+        long walk = ustime() - start;
+
+        // a tile per client in a cols wide grid, edges in made up percent
+        client **out = scratchalloc((n + 1) * sizeof(client *));
+        for (client *c = d->head; c; c = c->next) {
+            c->xp = c->slot % cols; c->yp = c->slot / cols;
+            c->wp = c->hp = 1;
+            geomtile(d, c);
+        }
+        start = ustime();
+        for (int q = 0; q < queries; q++) {
+            seed = seed * 1103515245 + 12345;
+            sink += geomedge(d, TLEFT, seed % cols, out);
+        }
+        long edge = ustime() - start;
+        start = ustime();
+        for (int q = 0; q < queries; q++) {
+            int k = 0;
+            seed = seed * 1103515245 + 12345;
+            for (client *c = d->head; c; c = c->next)
+                if (!ISFT(c) && c->xp == (int)(seed % cols))
+                    out[k++] = c;
+            sink += k;
+        }
+        long edgewalk = ustime() - start;
+        scratchreset();
+        printf("4wm: %4d windows, hit test %.1fns, list walk %.1fns, edge match %.1fns, list walk %.1fns\n", n,
+               hit * 1e3 / queries, walk * 1e3 / queries, edge * 1e3 / queries, edgewalk * 1e3 / queries);
+        while (d->head) {
+            client *c = d->head;
+            removeclientfromlist(c, d);
+            poolput(&clientpool, c);
+        }
+    }
+    (void)sink;
+}
+
+// on the press of a button check to see if there's a binded function to call 
+// TODO: if we make the mouse able to switch monitors we could eliminate a call
+//       to wintomon
+void buttonpress(xcb_generic_event_t *e) {
+    xcb_button_press_event_t *ev = (xcb_button_press_event_t*)e; 
+    #if MENU
+    if (openmenu && ev->event == openmenu->win) {
+        menuclick(ev);
+        return;
+    }
+    #endif
+    monitor *m = wintomon(ev->event);
+    client *c = wintoclient(ev->event);
+
+    #if CLICK_TO_FOCUS 
+    if (ev->detail == XCB_BUTTON_INDEX_1) {
+        if (m && m != selmon) {
+            monitor *mold = selmon;
+            client *cold = desktops[selmon->curr_dtop].current;
+            selmon = m;
+            #if PRETTY_PRINT
+            updatews();
+            updatemode();
+            updatedir();
+            desktopinfo();
+            #endif
+            if (cold)
+                setclientborders(cold, &desktops[mold->curr_dtop], mold);
+        }
+     
         if (c && c != desktops[m->curr_dtop].current) {
             desktops[m->curr_dtop].prevfocus = desktops[m->curr_dtop].current;
             desktops[m->curr_dtop].current = c;
@@ -487,10 +1952,44 @@ void buttonpress(xcb_generic_event_t *e) {
 
     #if CLICK_TO_FOCUS
     xcb_allow_events(dis, XCB_ALLOW_REPLAY_POINTER, ev->time);
-    xcb_flush(dis);
+    FLUSH();
     #endif
 }
 
+// 4wm -d, print a trace written by dumptrace() as a timeline, oldest first
+int decodetrace(const char *file) {
+    static const char *points[TP_COUNT] = { "event", "commit", "manage", "retile", "borders", "focus", "wintoclient" };
+    tracehdr h;
+    tracerec r;
+    char name[16];
+    uint64_t first = 0, prev = 0, n, i;
+    FILE *f;
+
+    if (!(f = fopen(file, "r")))
+        err(EXIT_FAILURE, "cannot open %s", file);
+    if (fread(&h, sizeof(h), 1, f) != 1 || h.magic != TRACE_MAGIC || !h.size)
+        errx(EXIT_FAILURE, "%s is not a 4wm trace", file);
+    // the ring wrapped if more records were made than it holds
+    n = h.head < h.size ? h.head : h.size;
+    printf("%10s %8s %10s  %-12s %-18s %-10s %s\n", "ms", "+us", "took(us)", "point", "event", "window", "arg");
+    for (i = h.head - n; i < h.head; i++) {
+        if (fseek(f, sizeof(h) + (i % h.size) * sizeof(r), SEEK_SET) < 0 || fread(&r, sizeof(r), 1, f) != 1)
+            break;
+        if (i == h.head - n)
+            first = prev = r.time;
+        printf("%10.3f %8lu %10u  %-12s ", (r.time - first) / 1e3, (unsigned long)(r.time - prev), r.duration,
+               r.point < TP_COUNT ? points[r.point] : "?");
+        if (r.point == TP_EVENT)
+            printf("%-18s ", eventname(r.event, name, sizeof(name)));
+        else
+            printf("%-18s ", "");
+        printf("0x%08x %u\n", r.window, r.arg);
+        prev = r.time;
+    }
+    fclose(f);
+    return EXIT_SUCCESS;
+}
+
 // focus another desktop
 //
 // to avoid flickering
@@ -528,22 +2027,22 @@ void change_desktop(const Arg *arg) {
         retile(n, selmon);
         DEBUG("change_desktop: mapping new windows on current monitor\n"); 
         if (n->current)
-            xcb_map_window(dis, n->current->win);
+            xb->map(n->current->win);
         for (client *c = n->head; c; c = c->next)
-            xcb_map_window(dis, c->win);
+            xb->map(c->win);
  
         DEBUG("change_desktop: unmapping old windows on current monitor\n");
         for (client *c = d->head; c; c = c->next) 
             if (c != d->current)
-                xcb_unmap_window(dis, c->win);
+                xb->unmap(c->win);
         if (d->current)
-            xcb_unmap_window(dis, d->current->win); 
+            xb->unmap(d->current->win); 
     } 
   
     if(n->current)
         focus(n->current, n, selmon);
     else
-        xcb_set_input_focus(dis, XCB_INPUT_FOCUS_POINTER_ROOT, screen->root, XCB_CURRENT_TIME);
+        xb->focus(XCB_INPUT_FOCUS_POINTER_ROOT, screen->root, XCB_CURRENT_TIME);
 
     #if PRETTY_PRINT
     updatews();
@@ -562,22 +2061,84 @@ void changegap(const Arg *arg) {
     }
 }
 
-// remove all windows in all desktops by sending a delete message
-void cleanup(void) {
-    xcb_query_tree_reply_t  *query;
-    xcb_window_t *c;
+// SIGHUP or a change to ~/.Xdefaults, read the colors again and redraw
+// only what uses a color that changed. hidden desktops are redrawn anyway
+// once they are shown
+void checkreload(void) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    unsigned int border[BORDER_COLORS], menu[12], *old[BORDER_COLORS] = { &win_focus, &win_unfocus, &win_outer, &win_flt };
+    bool changed[BORDER_COLORS], any = false;
+    const char *file = strrchr(xdefaults, '/') + 1;
+    ssize_t len;
+
+    if (pollfds[POLL_RELOAD].revents) {
+        while ((len = read(pollfds[POLL_RELOAD].fd, buf, sizeof(buf))) > 0)
+            for (char *p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((struct inotify_event*)p)->len) {
+                struct inotify_event *ev = (struct inotify_event*)p;
+                if (ev->len && strcmp(ev->name, file) == 0)
+                    reloadpending = true;
+            }
+        pollfds[POLL_RELOAD].revents = 0;
+    }
+    if (!reloadpending)
+        return;
+    reloadpending = false;
+    DEBUG("checkreload: reloading colors\n");
+
+    loadcolors(border, menu);
+    for (int i = 0; i < BORDER_COLORS; i++) {
+        any |= (changed[i] = border[i] != *old[i]);
+        *old[i] = border[i];
+    }
+    for (monitor *m = mons; m && any; m = m->next) {
+        desktop *d = &desktops[m->curr_dtop];
+        for (client *c = d->head; c; c = c->next)
+            if (changed[c->isfloating ? COL_FLOAT : COL_OUTER] ||
+                changed[c == d->current && m == selmon ? COL_FOCUS : COL_UNFOCUS])
+                setclientborders(c, d, m);
+    }
 
-    xcb_ungrab_key(dis, XCB_GRAB_ANY, screen->root, XCB_MOD_MASK_ANY);
-    if ((query = xcb_query_tree_reply(dis,xcb_query_tree(dis,screen->root),0))) {
-        c = xcb_query_tree_children(query);
-        for (unsigned int i = 0; i != query->children_len; ++i) deletewindow(c[i]);
-        free(query);
+    #if MENU
+    any = false;
+    for (int i = 0; i < 12; i++)
+        if (menu[i] != xres.color[i]) {
+            xres.color[i] = menu[i];
+            xb->changegc(xres.gc_color[i], XCB_GC_FOREGROUND, &menu[i]);
+            xb->changegc(xres.font_gc[i], XCB_GC_BACKGROUND, &menu[i]);
+            any = true;
+        }
+    for (Menu *m = menus; m && any; m = m->next)
+        drawmenu(m);
+    if (openmenu && any) {
+        xb->copy(openmenu->pmaps[openmenu->page], openmenu->win, xres.gc_copy, 0, 0, 0, 0, openmenu->w, openmenu->h);
+        selectmenucell(openmenu, openmenu->sel);
     }
-    xcb_set_input_focus(dis, XCB_INPUT_FOCUS_POINTER_ROOT, screen->root, XCB_CURRENT_TIME);
+    #endif
+}
+
+// let go of the windows and release everything 4wm holds, the requests for
+// every window are sent in one go and flushed before the connection closes
+void cleanup(void) {
+    client *c;
+
+    xb->ungrabkey(XCB_GRAB_ANY, screen->root, XCB_MOD_MASK_ANY);
+    // leave the windows where they are, with their desktop noted so the
+    // next 4wm can adopt() them. windows of hidden desktops stay unmapped
+    for (int i = 0; i < DESKTOPS; i++)
+        for (c = desktops[i].head; c; c = c->next) {
+            monitor *m;
+            for (m = mons; m && m->curr_dtop != i; m = m->next);
+            uint32_t state[2] = { m ? XCB_ICCCM_WM_STATE_NORMAL : XCB_ICCCM_WM_STATE_ICONIC, XCB_NONE };
+            xb->property(XCB_PROP_MODE_REPLACE, c->win, wmatoms[WM_STATE], wmatoms[WM_STATE], 32, 2, state);
+            xcb_ewmh_set_wm_desktop(ewmh, c->win, i);
+        }
+    xb->focus(XCB_INPUT_FOCUS_POINTER_ROOT, screen->root, XCB_CURRENT_TIME);
     
     xcb_ewmh_connection_wipe(ewmh);
     if(ewmh)
         free(ewmh);
+    if (keysyms)
+        xcb_key_symbols_free(keysyms);
 
     // free each monitor
     monitor *m, *t;
@@ -588,17 +2149,51 @@ void cleanup(void) {
     #if MENU
     // free each menu and each menuentry
     Menu *men, *tmen;
-    Menu_Entry *ent, *tent;
     for (men = menus; men; men = tmen) {
         tmen = men->next;
-        for (ent = men->head; ent; ent = tent) {
-            tent = ent->next;
-            free(ent);
-        }
+        free(men->grid);
+        free(men->pmaps);
         free(men);
     }
+    pooldestroy(&entrypool);
+    #endif
+    for (cmdpath *cp = cmdpaths, *next; cp; cp = next) {
+        next = cp->next;
+        free(cp->name);
+        free(cp->path);
+        free(cp);
+    }
+    #if AUDIT
+    auditreport();
+    #endif
+    for (int i = 0; i < nprocs; i++)
+        if (pollfds[POLL_CHILDREN + i].fd >= 0)
+            close(pollfds[POLL_CHILDREN + i].fd);
+    if (pollfds[POLL_RELOAD].fd >= 0)
+        close(pollfds[POLL_RELOAD].fd);
+    close(pollfds[POLL_SIGNAL].fd);
+    close(sigwritefd);
+    free(procs);
+    free(pollfds);
+    pooldestroy(&clientpool);
+    scratchreset();
+    free(scratch.base);
+    free(scratch.spill);
+    #if LAYOUTS
+    for (int i = 0; i < DESKTOPS; i++)
+        free(pending[i]);
+    #endif
+    FLUSH(); // xcb_disconnect() drops what is still buffered
+    #if READER
+    stopreader();
     #endif
     xcb_disconnect(dis);
+    #if SNAPSHOT
+    if (snap) {
+        munmap(snap, sizeof(snapshot));
+        unlink(snappath);
+    }
+    #endif
     #if PRETTY_PRINT
     kill(pid, SIGKILL);
     free(pp.ws);
@@ -636,7 +2231,7 @@ void client_to_desktop(const Arg *arg) {
     else if(m)
         retile(n, m);
     else
-        xcb_unmap_window(dis, o->win);
+        xb->unmap(o->win);
 
     #if PRETTY_PRINT
     updatews();
@@ -649,12 +2244,10 @@ void client_to_desktop(const Arg *arg) {
 client* clientbehindfloater(desktop *d) {
     client *c = NULL;
     // try to find the first one behind the pointer
-    xcb_query_pointer_reply_t *pointer = xcb_query_pointer_reply(dis, xcb_query_pointer(dis, screen->root), 0);
+    xcb_query_pointer_reply_t *pointer = RECREPLY(xcb_query_pointer_reply(dis, xcb_query_pointer(dis, screen->root), 0));
     if (pointer) {
-        int mx = pointer->root_x; int my = pointer->root_y;
-        for (c = d->head; c; c = c->next)
-            if(!ISFT(c) && INRECT(mx, my, c->x, c->y, c->w, c->h))
-                break;
+        c = geomhit(d, pointer->root_x, pointer->root_y);
+        free(pointer);
     }
     // just find the first tiled client.
     if (!c)
@@ -706,89 +2299,152 @@ desktop *clienttodesktop(client *c) {
 
 client** clientstothebottom(client *w, desktop *d, bool samesize)
 {
-    client **l = (client**)malloc_safe((d->count + 1) * sizeof(client*));
+    client **l = scratchalloc((geoms[d - desktops].n + 1) * sizeof(client*));
+    int n = geomedge(d, TTOP, w->yp + w->hp, l);
     int size = 0;
     int i = 0;
 
-    for(client *x = d->head; x; x = x->next)
+    for(int j = 0; j < n; j++) {
+        client *x = l[j];
         if(!ISFT(x) && x->yp == (w->yp + w->hp)) //directly below
             if(samesize ? 
                     (x->xp >= w->xp && (x->xp + x->wp) <= (w->xp + w->wp)) :   //width == or <=
                     ((x->xp >= w->xp || (x->xp + x->wp) >= (w->xp + w->wp)) && x->xp < (w->xp + w->wp))) { 
                 l[i++] = x;
                 size += x->wp;
-                if(samesize ? (size == w->wp) : true)
+                if(samesize ? (size == w->wp) : true) {
+                    l[i] = NULL;
                     return l;
+                }
             }
+    }
 
-    free(l);
     return NULL;
 }
 
 client** clientstotheleft(client *w, desktop *d, bool samesize)
 {
-    client **l = (client**)malloc_safe((d->count + 1) * sizeof(client*));
+    client **l = scratchalloc((geoms[d - desktops].n + 1) * sizeof(client*));
+    int n = geomedge(d, TRIGHT, w->xp, l);
     int size = 0;
     int i = 0;
 
-    for(client *x = d->head; x; x = x->next)
+    for(int j = 0; j < n; j++) {
+        client *x = l[j];
         if(!ISFT(x) && (x->xp + x->wp) == w->xp) //directly to the left
             if(samesize ? 
                     (x->yp >= w->yp && (x->yp + x->hp) <= (w->yp + w->hp)) :  //height == or <=
                     ((x->yp >= w->yp || (x->yp + x->hp) >= (w->yp + w->hp)) && x->yp < (w->yp + w->hp))) { 
                 l[i++] = x;
                 size += x->hp;
-                if(samesize ? (size == w->hp) : true)
+                if(samesize ? (size == w->hp) : true) {
+                    l[i] = NULL;
                     return l;
+                }
             }
+    }
 
-    free(l);
     return NULL;
 }
 
 client** clientstotheright(client *w, desktop *d, bool samesize)
 {
-    client **l = (client**)malloc_safe((d->count + 1) * sizeof(client*));
+    client **l = scratchalloc((geoms[d - desktops].n + 1) * sizeof(client*));
+    int n = geomedge(d, TLEFT, w->xp + w->wp, l);
     int size = 0;
     int i = 0;
 
-    for(client *x = d->head; x; x = x->next)
+    for(int j = 0; j < n; j++) {
+        client *x = l[j];
         if(!ISFT(x) && (w->xp + w->wp) == x->xp) //directly to the right
             if(samesize ? 
                     (x->yp >= w->yp && (x->yp + x->hp) <= (w->yp + w->hp)) : //height == or <=
                     ((x->yp >= w->yp || (x->yp + x->hp) >= (w->yp + w->hp)) && x->yp < (w->yp + w->hp))) { 
                 l[i++] = x;
                 size += x->hp;
-                if(samesize ? (size == w->hp) : true)
+                if(samesize ? (size == w->hp) : true) {
+                    l[i] = NULL;
                     return l;
+                }
             }
+    }
 
-    free(l);
     return NULL;
 }
 
 client** clientstothetop(client *w, desktop *d, bool samesize)
 {
-    client **l = (client**)malloc_safe((d->count + 1) * sizeof(client*));
+    client **l = scratchalloc((geoms[d - desktops].n + 1) * sizeof(client*));
+    int n = geomedge(d, TBOTTOM, w->yp, l);
     int size = 0;
     int i = 0;
 
-    for(client *x = d->head; x; x = x->next) {
+    for(int j = 0; j < n; j++) {
+        client *x = l[j];
         if(!ISFT(x) && w->yp == (x->yp + x->hp)) //directly above
             if(samesize ? 
                     (x->xp >= w->xp && (x->xp + x->wp) <= (w->xp + w->wp)) : //width == or <=
                     ((x->xp >= w->xp || (x->xp + x->wp) >= (w->xp + w->wp)) && x->xp < (w->xp + w->wp))) { 
                 l[i++] = x;
                 size += x->wp;
-                if(samesize ? (size == w->wp) : true)
+                if(samesize ? (size == w->wp) : true) {
+                    l[i] = NULL;
                     return l;
+                }
             }
     }
 
-    free(l);
     return NULL;
 }
 
+// commit the state after a batch of events, everything shown to the
+// outside is brought up to date once instead of after every event
+void commit(void) {
+    #if AUDIT
+    curhandler = HANDLER_COMMIT;
+    #endif
+    if (nmapqueue) {
+        manage(mapqueue, NULL, nmapqueue);
+        nmapqueue = 0;
+    }
+    #if STATUS
+    if (updatetitles(false)) {
+        #if PRETTY_PRINT
+        desktopinfo();
+        #endif
+    }
+    #endif
+    #if BAR
+    drawbars();
+    #endif
+    #if SNAPSHOT
+    publishsnapshot();
+    #endif
+    endlayout();
+    #if AUDIT
+    curhandler = HANDLER_NONE;
+    #endif
+    scratchreset();
+}
+
+#if MENU
+// hide the open menu and give focus back
+void closemenu(void) {
+    desktop *d = &desktops[selmon->curr_dtop];
+
+    xcb_ungrab_keyboard(dis, XCB_CURRENT_TIME);
+    xb->unmap(openmenu->win);
+    openmenu = NULL;
+    #if MENU_SEARCH
+    pindex.query[(pindex.qlen = 0)] = '\0';
+    #endif
+    if (d->current)
+        focus(d->current, d, selmon);
+    else
+        xb->focus(XCB_INPUT_FOCUS_POINTER_ROOT, screen->root, XCB_CURRENT_TIME);
+}
+#endif
+
 // a configure request means that the window requested changes in its geometry
 // state. if the window doesnt have a client set the appropriate values as 
 // requested, else fake it.
@@ -847,7 +2503,7 @@ void configurerequest(xcb_generic_event_t *e) {
         if (ev->value_mask & XCB_CONFIG_WINDOW_BORDER_WIDTH) v[i++] = ev->border_width;
         if (ev->value_mask & XCB_CONFIG_WINDOW_SIBLING)      v[i++] = ev->sibling;
         if (ev->value_mask & XCB_CONFIG_WINDOW_STACK_MODE)   v[i++] = ev->stack_mode;
-        xcb_configure_window_checked(dis, ev->window, ev->value_mask, v);
+        layoutrequest(xcb_configure_window_checked(dis, ev->window, ev->value_mask, v).sequence);
         if(c) {
             if (m)
                 setclientborders(c, &desktops[m->curr_dtop], m);
@@ -855,99 +2511,74 @@ void configurerequest(xcb_generic_event_t *e) {
                 setclientborders(c, &desktops[selmon->curr_dtop], selmon);
         }
     } else { // has a client, fake configure it
-        xcb_send_event(dis, false, c->win, XCB_EVENT_MASK_STRUCTURE_NOTIFY, (char*)ev);
+        xb->send(false, c->win, XCB_EVENT_MASK_STRUCTURE_NOTIFY, (char*)ev);
     }
-    xcb_flush(dis);
+    FLUSH();
 }
 
 #if MENU
 Menu* createmenu(char **list) {
     Menu *m = (Menu*)malloc_safe(sizeof(Menu));
-    Menu_Entry *mentry, *sentry = NULL, *itr = NULL;
-    int i, x, y;
 
     m->list = list;
-    for (i = 0; list[i]; i++) {
-        if (!m->head) {
-            mentry = createmenuentry(selmon->w/2 - 50, selmon->h/2 - 30, 100, 60, list[i]);
-            m->head = itr = sentry = mentry;
-        } else {
-            if (sentry->l && sentry->t && !sentry->b) {
-                x = sentry->x;
-                y = sentry->y + 60;
-                DEBUGP("createmenu: x %d y %d \n", x, y);
-                mentry = createmenuentry(x, y, 100, 60, list[i]);
-                sentry->b = itr->next = mentry;
-                mentry->t = sentry;
-                itr = itr->next;
-                if (sentry->r) {
-                    if (!sentry->r->r) sentry = sentry->r;
-                    else if (sentry->r->b) {
-                        sentry->r->b->l = mentry;
-                        mentry->r = sentry->r->b;
-                        sentry = sentry->r->b;
-                    }
-                } 
-            } else if (sentry->t && !sentry->l) {
-                x = sentry->x - 100;
-                y = sentry->y;
-                DEBUGP("createmenu: x %d y %d \n", x, y);
-                mentry = createmenuentry(x, y, 100, 60, list[i]);
-                sentry->l = itr->next = mentry;
-                mentry->r = sentry;
-                itr = itr->next;
-                if (sentry->b && sentry->b->l) {
-                    sentry->b->l->t = mentry;
-                    mentry->b = sentry->b->l;
-                    sentry = sentry->b->l;
-                }
-            } else if (sentry->r && !sentry->t) {
-                x = sentry->x;
-                y = sentry->y - 60;
-                DEBUGP("createmenu: x %d y %d \n", x, y);
-                mentry = createmenuentry(x, y, 100, 60, list[i]);
-                sentry->t = itr->next = mentry;
-                mentry->b = sentry;
-                itr = itr->next;
-                if (sentry->l && sentry->l->t) {
-                    sentry->l->t->r = mentry;
-                    mentry->l = sentry->l->t;
-                    sentry = sentry->l->t;
-                }
-            } else if (!sentry->r) { 
-                x = sentry->x + 100;
-                y = sentry->y;
-                DEBUGP("createmenu: x %d y %d \n", x, y);
-                mentry = createmenuentry(x, y, 100, 60, list[i]);
-                sentry->r = itr->next = mentry;
-                mentry->l = sentry;
-                itr = itr->next;
-                if (sentry->t && sentry->t->r) {
-                    sentry->t->r->b = mentry;
-                    mentry->t = sentry->t->r;
-                    while (sentry->r) {
-                        sentry = sentry->r;
-                        if (sentry->t) sentry = sentry->t;
-                    }
-                }
-            } 
-        }
-    }
+    m->head = NULL;
+    m->grid = NULL;
     m->next = NULL;
+    layoutmenu(m);
     return m;
 }
 
+// spread a menu's entries over the grid of cells that fits on selmon, the
+// entries of an earlier layout go back to the pool
+void layoutmenu(Menu *m) {
+    Menu_Entry *mentry, *itr;
+    int i, n, cells, *spiral;
+
+    for (mentry = m->head; mentry; mentry = itr) {
+        itr = mentry->next;
+        poolput(&entrypool, mentry);
+    }
+    free(m->grid);
+    m->head = itr = NULL;
+    for (n = 0; m->list[n]; n++);
+    m->cols = selmon->w/100 > 0 ? selmon->w/100 : 1;
+    m->rows = selmon->h/60 > 0 ? selmon->h/60 : 1;
+    m->ox = (selmon->w - m->cols*100)/2;
+    m->oy = (selmon->h - m->rows*60)/2;
+    cells = m->cols * m->rows;
+    m->npages = n ? (n + cells - 1)/cells : 1;
+    m->page = 0;
+    m->sel = -1;
+    m->grid = (Menu_Entry**)malloc_safe(m->npages * cells * sizeof(Menu_Entry*));
+    memset(m->grid, 0, m->npages * cells * sizeof(Menu_Entry*));
+
+    spiral = (int*)malloc_safe(cells * sizeof(int));
+    menuspiral(m->cols, m->rows, spiral);
+    for (i = 0; i < n; i++) {
+        int cell = spiral[i % cells];
+        mentry = createmenuentry(m->ox + cell%m->cols*100, m->oy + cell/m->cols*60, 100, 60, m->list[i]);
+        DEBUGP("createmenu: x %d y %d \n", mentry->x, mentry->y);
+        mentry->page = i / cells;
+        mentry->cell = cell;
+        m->grid[mentry->page * cells + cell] = mentry;
+        if (itr)
+            itr = itr->next = mentry;
+        else
+            m->head = itr = mentry;
+    }
+    free(spiral);
+}
+
 Menu_Entry* createmenuentry(int x, int y, int w, int h, char *cmd) {
-    Menu_Entry *m = (Menu_Entry*)malloc_safe(sizeof(Menu_Entry));
+    Menu_Entry *m = poolget(&entrypool);
     
     m->cmd[0] = cmd;
     m->cmd[1] = NULL; 
-    m->rectangles = (xcb_rectangle_t*)malloc_safe(sizeof(xcb_rectangle_t));
-    m->x = m->rectangles->x = x;
-    m->y = m->rectangles->y = y;
-    m->rectangles->width = w;
-    m->rectangles->height = h;
-    m->next = m->b = m->l = m->r = m->t = NULL;
+    m->x = m->rectangle.x = x;
+    m->y = m->rectangle.y = y;
+    m->rectangle.width = w;
+    m->rectangle.height = h;
+    m->next = NULL;
     // we might also want to save coordinates for the string to print
     return m;
 }
@@ -978,7 +2609,7 @@ void deletewindow(xcb_window_t w) {
     ev.type = wmatoms[WM_PROTOCOLS];
     ev.data.data32[0] = wmatoms[WM_DELETE_WINDOW];
     ev.data.data32[1] = XCB_CURRENT_TIME;
-    xcb_send_event(dis, 0, w, XCB_EVENT_MASK_NO_EVENT, (char*)&ev);
+    xb->send(0, w, XCB_EVENT_MASK_NO_EVENT, (char*)&ev);
 }
 
 #if PRETTY_PRINT
@@ -1008,6 +2639,112 @@ void destroynotify(xcb_generic_event_t *e) {
     #endif
 }
 
+#if BAR
+// append a string to a segment's cells in the given color
+void barcells(uint16_t *cells, int *len, int color, const char *str) {
+    for (; str && *str && *len < BAR_CELLS; str++)
+        cells[(*len)++] = color << 8 | ((*str >= ' ' && *str <= '~') ? *str : '?');
+}
+
+// bring the bar of the given monitor up to date
+//
+// the cells of every segment are rebuilt and compared to what was drawn,
+// unchanged cells are left alone. when a segment changes length every
+// segment after it has moved and is redrawn entirely
+void drawbar(monitor *m) {
+    static uint16_t cells[SEG_COUNT][BAR_CELLS];
+    char *tags_ws[] = BAR_TAGS_WS, *tags_mode[] = BAR_TAGS_MODE, *tags_dir[] = BAR_TAGS_DIR;
+    desktop *d = &desktops[m->curr_dtop];
+    bar *b = m->bar;
+    int len[SEG_COUNT] = { 0 }, color, i, x, y;
+    bool onmonitor, moved = b->damaged;
+    char num[8];
+
+    for (i = 0; i < DESKTOPS; i++) {
+        onmonitor = false;
+        for (monitor *o = mons; o; o = o->next)
+            if ((onmonitor = (i == o->curr_dtop)))
+                break;
+        color = i == selmon->curr_dtop ? BAR_CURRENT : (onmonitor || desktops[i].head) ? BAR_VISIBLE : BAR_HIDDEN;
+        snprintf(num, sizeof(num), "%d", i + 1);
+        barcells(cells[SEG_WS], &len[SEG_WS], color, tags_ws[i] ? tags_ws[i] : num);
+        barcells(cells[SEG_WS], &len[SEG_WS], color, " ");
+    }
+    barcells(cells[SEG_MODE], &len[SEG_MODE], BAR_MODE, tags_mode[d->mode]);
+    barcells(cells[SEG_MODE], &len[SEG_MODE], BAR_MODE, " ");
+    barcells(cells[SEG_DIR], &len[SEG_DIR], BAR_DIR, tags_dir[d->direction]);
+    barcells(cells[SEG_DIR], &len[SEG_DIR], BAR_DIR, " ");
+    barcells(cells[SEG_TITLE], &len[SEG_TITLE], BAR_TITLE, d->current ? d->current->title : NULL);
+
+    y = (PANEL_HEIGHT - atlas.ch) / 2;
+    for (int s = 0, sx = 0; s < SEG_COUNT; sx += len[s] * atlas.cw, s++) {
+        if (!moved && len[s] == b->len[s] && !memcmp(cells[s], b->cells[s], len[s] * sizeof(uint16_t)))
+            continue;
+        DEBUGP("drawbar: redrawing segment %d\n", s);
+        for (i = 0, x = sx; i < len[s] && x + atlas.cw <= b->w; i++, x += atlas.cw)
+            if (moved || i >= b->len[s] || cells[s][i] != b->cells[s][i])
+                xb->copy(atlas.pmap, b->win, atlas.gc, ((cells[s][i] & 0xFF) - ' ') * atlas.cw,
+                              (cells[s][i] >> 8) * atlas.ch, x, y, atlas.cw, atlas.ch);
+        // whatever is left after the last segment is background
+        if (s == SEG_TITLE && x < b->w && (moved || len[s] < b->len[s]))
+            xb->fill(b->win, atlas.gc, 1, &(xcb_rectangle_t){ x, 0, b->w - x, PANEL_HEIGHT });
+        moved |= len[s] != b->len[s];
+        memcpy(b->cells[s], cells[s], len[s] * sizeof(uint16_t));
+        b->len[s] = len[s];
+    }
+    b->damaged = false;
+}
+
+void drawbars(void) {
+    for (monitor *m = mons; m; m = m->next)
+        if (m->bar)
+            drawbar(m);
+}
+#endif
+
+// the window an event is about, for the trace
+xcb_window_t eventwindow(const xcb_generic_event_t *ev) {
+    switch (ev->response_type & ~0x80) {
+        case XCB_KEY_PRESS:
+        case XCB_KEY_RELEASE:
+        case XCB_BUTTON_PRESS:
+        case XCB_BUTTON_RELEASE:
+        case XCB_ENTER_NOTIFY:
+        case XCB_LEAVE_NOTIFY:    return ((xcb_enter_notify_event_t *)ev)->event;
+        case XCB_FOCUS_IN:
+        case XCB_FOCUS_OUT:       return ((xcb_focus_in_event_t *)ev)->event;
+        case XCB_EXPOSE:          return ((xcb_expose_event_t *)ev)->window;
+        case XCB_DESTROY_NOTIFY:  return ((xcb_destroy_notify_event_t *)ev)->window;
+        case XCB_UNMAP_NOTIFY:    return ((xcb_unmap_notify_event_t *)ev)->window;
+        case XCB_MAP_REQUEST:     return ((xcb_map_request_event_t *)ev)->window;
+        case XCB_CONFIGURE_REQUEST: return ((xcb_configure_request_event_t *)ev)->window;
+        case XCB_PROPERTY_NOTIFY: return ((xcb_property_notify_event_t *)ev)->window;
+        case XCB_CLIENT_MESSAGE:  return ((xcb_client_message_event_t *)ev)->window;
+        default:                  return 0;
+    }
+}
+
+// the name of an event type for metrics and traces, or its number
+const char* eventname(int type, char *buf, size_t size) {
+    static const char *names[] = { [XCB_KEY_PRESS] = "KeyPress", [XCB_KEY_RELEASE] = "KeyRelease",
+        [XCB_BUTTON_PRESS] = "ButtonPress", [XCB_BUTTON_RELEASE] = "ButtonRelease",
+        [XCB_MOTION_NOTIFY] = "MotionNotify", [XCB_ENTER_NOTIFY] = "EnterNotify",
+        [XCB_LEAVE_NOTIFY] = "LeaveNotify", [XCB_FOCUS_IN] = "FocusIn", [XCB_FOCUS_OUT] = "FocusOut",
+        [XCB_EXPOSE] = "Expose", [XCB_CREATE_NOTIFY] = "CreateNotify", [XCB_DESTROY_NOTIFY] = "DestroyNotify",
+        [XCB_UNMAP_NOTIFY] = "UnmapNotify", [XCB_MAP_NOTIFY] = "MapNotify", [XCB_MAP_REQUEST] = "MapRequest",
+        [XCB_CONFIGURE_NOTIFY] = "ConfigureNotify", [XCB_CONFIGURE_REQUEST] = "ConfigureRequest",
+        [XCB_PROPERTY_NOTIFY] = "PropertyNotify", [XCB_CLIENT_MESSAGE] = "ClientMessage",
+        [XCB_MAPPING_NOTIFY] = "MappingNotify", [HANDLER_COMMIT] = "commit" };
+
+    if (type == HANDLER_NONE)
+        snprintf(buf, size, "none");
+    else if (type >= 0 && type < (int)LENGTH(names) && names[type])
+        snprintf(buf, size, "%s", names[type]);
+    else
+        snprintf(buf, size, "%d", type);
+    return buf;
+}
+
 // TODO: we dont need this event for FOLLOW_MOUSE false
 // when the mouse enters a window's borders
 // the window, if notifying of such events (EnterWindowMask)
@@ -1019,6 +2756,11 @@ void enternotify(xcb_generic_event_t *e) {
         DEBUG("enternotify: leaving under user FOLLOW_MOUSE setting or event rules to not enter\n");
         return;
     }
+    if (ourcrossing(e)) {
+        DEBUG("enternotify: a window moved under the pointer, the pointer didn't move\n");
+        COUNT(crossingsignored);
+        return;
+    }
 
     desktop *d = &desktops[selmon->curr_dtop];
 
@@ -1049,18 +2791,41 @@ void enternotify(xcb_generic_event_t *e) {
     }
 }
 
-#if PRETTY_PRINT
 // Expose event means we should redraw our windows
 void expose(xcb_generic_event_t *e) { 
     monitor *m;
     xcb_expose_event_t *ev = (xcb_expose_event_t*)e;
 
+    #if MENU
+    if (openmenu && ev->window == openmenu->win) {
+        xb->copy(openmenu->pmaps[openmenu->page], openmenu->win, xres.gc_copy, ev->x, ev->y, ev->x, ev->y, ev->width, ev->height);
+        if (ev->count == 0)
+            selectmenucell(openmenu, openmenu->sel);
+        #if MENU_SEARCH
+        if (pindex.qlen && ev->count == 0)
+            drawsearch();
+        #endif
+        return;
+    }
+    #endif
+
+    #if BAR
+    // bars are redrawn once the current batch of events is done
+    for (m = mons; m; m = m->next)
+        if (m->bar && m->bar->win == ev->window) {
+            m->bar->damaged = true;
+            return;
+        }
+    #endif
+    #if PRETTY_PRINT
     if(ev->count == 0 && (m = wintomon(ev->window))){
         // redraw windows - xcb_flush?
         desktopinfo();
     }
+    #else
+    (void)m;
+    #endif
 }    
-#endif
 
 // highlight borders and set active window and input focus
 // if given current is NULL then delete the active window property
@@ -1076,15 +2841,76 @@ void expose(xcb_generic_event_t *e) {
 // a window should have borders in any case, except if
 //  - the window is the only window on screen
 //  - the mode is MONOCLE or VIDEO
+#if MENU
+// show another page of the open menu
+void flipmenu(Menu *m, int page) {
+    if (page < 0 || page >= m->npages || page == m->page)
+        return;
+    m->page = page;
+    m->sel = -1;
+    xb->copy(m->pmaps[page], m->win, xres.gc_copy, 0, 0, 0, 0, m->w, m->h);
+    #if MENU_SEARCH
+    if (pindex.qlen)
+        drawsearch();
+    #endif
+}
+#endif
+
+#if LAYOUTS
+// r closed and no window borders all of one of its sides, give its space
+// to an empty tile of an applied layout that does. false if there is none
+bool refitslot(const client *r, const desktop *d) {
+    for (int i = 0; i < npending[d - desktops]; i++) {
+        layoutslot *s = &pending[d - desktops][i];
+        if (s->yp == r->yp && s->hp == r->hp && (s->xp + s->wp == r->xp || r->xp + r->wp == s->xp)) {
+            s->xp = s->xp < r->xp ? s->xp : r->xp;
+            s->wp += r->wp;
+        } else if (s->xp == r->xp && s->wp == r->wp && (s->yp + s->hp == r->yp || r->yp + r->hp == s->yp)) {
+            s->yp = s->yp < r->yp ? s->yp : r->yp;
+            s->hp += r->hp;
+        } else
+            continue;
+        DEBUGP("refitslot: an empty tile took the space of %u\n", r->win);
+        return true;
+    }
+    return false;
+}
+
+// give c an empty tile of an applied layout if one waits for its class,
+// the reply for cookie is read either way
+bool fillslot(client *c, int desktop, xcb_get_property_cookie_t cookie) {
+    xcb_icccm_get_wm_class_reply_t class;
+    int i = npending[desktop];
+
+    if (ISFT(c) || !npending[desktop]) {
+        xcb_discard_reply(dis, cookie.sequence);
+        return false;
+    }
+    if (XREPLY(xcb_icccm_get_wm_class_reply(dis, cookie, &class, NULL)) == 1) {
+        for (i = 0; i < npending[desktop] && strcmp(class.class_name, pending[desktop][i].class); i++);
+        xcb_icccm_get_wm_class_reply_wipe(&class);
+    } else if (xb == &fakebackend) // a replay, the class is on the fake window
+        for (i = 0; i < npending[desktop] && strcmp(fakewindow(c->win)->class, pending[desktop][i].class); i++);
+    if (i == npending[desktop])
+        return false;
+
+    layoutslot *s = &pending[desktop][i];
+    c->xp = s->xp; c->yp = s->yp; c->wp = s->wp; c->hp = s->hp;
+    geomtile(&desktops[desktop], c);
+    *s = pending[desktop][--npending[desktop]];
+    return true;
+}
+#endif
+
 void focus(client *c, desktop *d, const monitor *m) {
-     
+    TRACE(TP_FOCUS, c->win, 0, 0, d - desktops);
     if(d->prevfocus)
         setclientborders(d->prevfocus, d, m);
     setclientborders(c, d, m);
         
-    xcb_change_property(dis, XCB_PROP_MODE_REPLACE, screen->root, netatoms[NET_ACTIVE], XCB_ATOM_WINDOW, 32, 1, &c->win);
-    xcb_set_input_focus(dis, XCB_INPUT_FOCUS_POINTER_ROOT, c->win, XCB_CURRENT_TIME);
-    xcb_flush(dis);
+    xb->property(XCB_PROP_MODE_REPLACE, screen->root, netatoms[NET_ACTIVE], XCB_ATOM_WINDOW, 32, 1, &c->win);
+    xb->focus(XCB_INPUT_FOCUS_POINTER_ROOT, c->win, XCB_CURRENT_TIME);
+    FLUSH();
      
     #if PRETTY_PRINT
     desktopinfo();
@@ -1106,20 +2932,183 @@ void focusin(xcb_generic_event_t *e) {
     }
 
     if(!desktops[selmon->curr_dtop].current && ev->event != desktops[selmon->curr_dtop].current->win)
-        xcb_set_input_focus(dis, XCB_INPUT_FOCUS_POINTER_ROOT, desktops[selmon->curr_dtop].current->win,
+        xb->focus(XCB_INPUT_FOCUS_POINTER_ROOT, desktops[selmon->curr_dtop].current->win,
                             XCB_CURRENT_TIME);
 }
 
-// get a pixel with the requested color
-// to fill some window area - borders
-unsigned int getcolor(char* color) {
+// place an 8 bit color channel into the bits of a visual's channel mask
+unsigned int colorbits(unsigned int v, uint32_t mask) {
+    int shift, bits;
+
+    for (shift = 0; shift < 32 && !(mask >> shift & 1); shift++);
+    for (bits = 0; shift + bits < 32 && mask >> (shift + bits) & 1; bits++);
+    v = bits >= 8 ? v << (bits - 8) : v >> (8 - bits);
+    return (v << shift) & mask;
+}
+
+#if LAYOUTS
+// the WM_CLASS class of every client, all asked for at once
+void getclasses(client **cs, int n, char (*classes)[64]) {
+    xcb_get_property_cookie_t cookies[n + 1];
+    xcb_icccm_get_wm_class_reply_t class;
+
+    for (int i = 0; i < n; i++)
+        cookies[i] = xcb_icccm_get_wm_class_unchecked(dis, cs[i]->win);
+    for (int i = 0; i < n; i++) {
+        classes[i][0] = '\0';
+        if (XREPLY(xcb_icccm_get_wm_class_reply(dis, cookies[i], &class, NULL)) == 1) {
+            snprintf(classes[i], sizeof(classes[i]), "%s", class.class_name);
+            xcb_icccm_get_wm_class_reply_wipe(&class);
+        }
+    }
+}
+#endif
+
+// give the client a slot in the geometry of the desktop, with its rect
+void geomadd(const desktop *d, client *c) {
+    geomstore *g = &geoms[d - desktops];
+
+    if (g->n == g->max) { // grow by a multiple of GEOM_LANES, the rest stays empty
+        int max = g->max ? 2 * g->max : 4 * GEOM_LANES;
+        int32_t *a = aligned_alloc(GEOM_LANES * sizeof(int32_t), GEOM_ARRAYS * max * sizeof(int32_t));
+        if (!a || !(g->owner = realloc(g->owner, max * sizeof(client *))))
+            err(EXIT_FAILURE, "cannot allocate geometry");
+        memset(a, 0, GEOM_ARRAYS * max * sizeof(int32_t));
+        int32_t *old = g->x0, **arrays[GEOM_ARRAYS] = { &g->x0, &g->y0, &g->x1, &g->y1,
+                                                        &g->xp0, &g->yp0, &g->xp1, &g->yp1, &g->tiled };
+        for (int i = 0; i < GEOM_ARRAYS; i++) {
+            if (g->n)
+                memcpy(a + i * max, *arrays[i], g->n * sizeof(int32_t));
+            *arrays[i] = a + i * max;
+        }
+        free(old); // x0 starts the block
+        g->max = max;
+    }
+    g->owner[c->slot = g->n++] = c;
+    geomset(d, c, c->x, c->y, c->w, c->h);
+    geomtile(d, c);
+}
+
+// tiled clients with an edge of their tile at value, edge is TLEFT, TRIGHT,
+// TTOP or TBOTTOM. out has room for every client of the desktop, they are
+// in the order of the client list, returns how many
+int geomedge(const desktop *d, int edge, int value, client **out) {
+    const geomstore *g = &geoms[d - desktops];
+    const int32_t *e = edge == TLEFT ? g->xp0 : edge == TRIGHT ? g->xp1 : edge == TTOP ? g->yp0 : g->yp1;
+    int i = 0, n = 0;
+
+    #if defined(__AVX2__)
+    __m256i v = _mm256_set1_epi32(value);
+    for ( ; i < g->n; i += 8) {
+        __m256i hit = _mm256_and_si256(_mm256_cmpeq_epi32(_mm256_load_si256((const __m256i *)&e[i]), v),
+                                       _mm256_load_si256((const __m256i *)&g->tiled[i]));
+        for (int mask = _mm256_movemask_ps(_mm256_castsi256_ps(hit)); mask; mask &= mask - 1)
+            out[n++] = g->owner[i + __builtin_ctz(mask)];
+    }
+    #elif defined(__SSE2__)
+    __m128i v = _mm_set1_epi32(value);
+    for ( ; i < g->n; i += 4) {
+        __m128i hit = _mm_and_si128(_mm_cmpeq_epi32(_mm_load_si128((const __m128i *)&e[i]), v),
+                                    _mm_load_si128((const __m128i *)&g->tiled[i]));
+        for (int mask = _mm_movemask_ps(_mm_castsi128_ps(hit)); mask; mask &= mask - 1)
+            out[n++] = g->owner[i + __builtin_ctz(mask)];
+    }
+    #else
+    for ( ; i < g->n; i++)
+        if (g->tiled[i] && e[i] == value)
+            out[n++] = g->owner[i];
+    #endif
+    return n;
+}
+
+// the tiled client whose rect holds x, y, or NULL. tiles don't overlap
+client* geomhit(const desktop *d, int x, int y) {
+    const geomstore *g = &geoms[d - desktops];
+    int i = 0;
+
+    // x0 <= x < x1 is !(x0 > x) && x1 > x, there is no unsigned compare
+    #if defined(__AVX2__)
+    __m256i px = _mm256_set1_epi32(x), py = _mm256_set1_epi32(y);
+    for ( ; i < g->n; i += 8) {
+        __m256i inx = _mm256_andnot_si256(_mm256_cmpgt_epi32(_mm256_load_si256((const __m256i *)&g->x0[i]), px),
+                                          _mm256_cmpgt_epi32(_mm256_load_si256((const __m256i *)&g->x1[i]), px));
+        __m256i iny = _mm256_andnot_si256(_mm256_cmpgt_epi32(_mm256_load_si256((const __m256i *)&g->y0[i]), py),
+                                          _mm256_cmpgt_epi32(_mm256_load_si256((const __m256i *)&g->y1[i]), py));
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_and_si256(_mm256_and_si256(inx, iny),
+                                      _mm256_load_si256((const __m256i *)&g->tiled[i]))));
+        if (mask)
+            return g->owner[i + __builtin_ctz(mask)];
+    }
+    #elif defined(__SSE2__)
+    __m128i px = _mm_set1_epi32(x), py = _mm_set1_epi32(y);
+    for ( ; i < g->n; i += 4) {
+        __m128i inx = _mm_andnot_si128(_mm_cmpgt_epi32(_mm_load_si128((const __m128i *)&g->x0[i]), px),
+                                       _mm_cmpgt_epi32(_mm_load_si128((const __m128i *)&g->x1[i]), px));
+        __m128i iny = _mm_andnot_si128(_mm_cmpgt_epi32(_mm_load_si128((const __m128i *)&g->y0[i]), py),
+                                       _mm_cmpgt_epi32(_mm_load_si128((const __m128i *)&g->y1[i]), py));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_and_si128(_mm_and_si128(inx, iny),
+                                   _mm_load_si128((const __m128i *)&g->tiled[i]))));
+        if (mask)
+            return g->owner[i + __builtin_ctz(mask)];
+    }
+    #else
+    for ( ; i < g->n; i++)
+        if (g->tiled[i] && INRECT(x, y, g->x0[i], g->y0[i], g->x1[i] - g->x0[i], g->y1[i] - g->y0[i]))
+            return g->owner[i];
+    #endif
+    return NULL;
+}
+
+// give up the client's slot, the ones after it move down to keep the
+// order of the client list
+void geomremove(const desktop *d, client *c) {
+    geomstore *g = &geoms[d - desktops];
+    int32_t *arrays[GEOM_ARRAYS] = { g->x0, g->y0, g->x1, g->y1, g->xp0, g->yp0, g->xp1, g->yp1, g->tiled };
+    int n = --g->n - c->slot;
+
+    for (int i = 0; i < GEOM_ARRAYS; i++) {
+        memmove(&arrays[i][c->slot], &arrays[i][c->slot + 1], n * sizeof(int32_t));
+        arrays[i][g->n] = 0;
+    }
+    memmove(&g->owner[c->slot], &g->owner[c->slot + 1], n * sizeof(client *));
+    for (int i = c->slot; i < g->n; i++)
+        g->owner[i]->slot = i;
+}
+
+// note where the client was configured
+void geomset(const desktop *d, const client *c, int x, int y, int w, int h) {
+    geomstore *g = &geoms[d - desktops];
+
+    g->x0[c->slot] = x;
+    g->y0[c->slot] = y;
+    g->x1[c->slot] = x + w;
+    g->y1[c->slot] = y + h;
+    g->tiled[c->slot] = ISFT(c) ? 0 : -1;
+}
+
+// note the tile of the client, after its percentages changed
+void geomtile(const desktop *d, const client *c) {
+    geomstore *g = &geoms[d - desktops];
+
+    g->xp0[c->slot] = c->xp;
+    g->yp0[c->slot] = c->yp;
+    g->xp1[c->slot] = c->xp + c->wp;
+    g->yp1[c->slot] = c->yp + c->hp;
+    g->tiled[c->slot] = ISFT(c) ? 0 : -1;
+}
+
+// the pixel for a "#rrggbb" color. on a TrueColor visual it is computed
+// from the channel masks, anything else needs an AllocColor round trip
+unsigned int getcolor(const char *color) {
     xcb_colormap_t map = screen->default_colormap;
     xcb_alloc_color_reply_t *c;
     unsigned int r, g, b, rgb, pixel;
 
     rgb = xcb_get_colorpixel(color);
     r = rgb >> 16; g = rgb >> 8 & 0xFF; b = rgb & 0xFF;
-    c = xcb_alloc_color_reply(dis, xcb_alloc_color(dis, map, r * 257, g * 257, b * 257), NULL);
+    if (visual && visual->_class == XCB_VISUAL_CLASS_TRUE_COLOR)
+        return colorbits(r, visual->red_mask) | colorbits(g, visual->green_mask) | colorbits(b, visual->blue_mask);
+    c = XREPLY(xcb_alloc_color_reply(dis, xcb_alloc_color(dis, map, r * 257, g * 257, b * 257), NULL));
     if (!c)
         errx(EXIT_FAILURE, "error: cannot allocate color '%s'\n", color);
 
@@ -1130,9 +3119,9 @@ unsigned int getcolor(char* color) {
 void getoutputs(xcb_randr_output_t *outputs, const int len, xcb_timestamp_t timestamp) {
     // Walk through all the RANDR outputs (number of outputs == len) there
     // was at time timestamp.
-    xcb_randr_get_crtc_info_cookie_t icookie;
+    xcb_randr_get_crtc_info_cookie_t icookie[len];
     xcb_randr_get_crtc_info_reply_t *crtc = NULL;
-    xcb_randr_get_output_info_reply_t *output;
+    xcb_randr_get_output_info_reply_t *output, *replies[len];
     xcb_randr_get_output_info_cookie_t ocookie[len];
     monitor *m;
     int i, n;
@@ -1141,20 +3130,25 @@ void getoutputs(xcb_randr_output_t *outputs, const int len, xcb_timestamp_t time
     // get output cookies
     for (i = 0; i < len; i++) 
         ocookie[i] = xcb_randr_get_output_info(dis, outputs[i], timestamp);
+    // then the crtc of every output at once
+    for (i = 0; i < len; i++)
+        if ((replies[i] = RECREPLY(xcb_randr_get_output_info_reply(dis, ocookie[i], NULL))) && replies[i]->crtc != XCB_NONE)
+            icookie[i] = xcb_randr_get_crtc_info(dis, replies[i]->crtc, timestamp);
 
     for (i = 0; i < len; i ++) { /* Loop through all outputs. */
-        output = xcb_randr_get_output_info_reply(dis, ocookie[i], NULL);
+        output = replies[i];
 
         if (output == NULL) 
             continue;
         //asprintf(&name, "%.*s",xcb_randr_get_output_info_name_length(output),xcb_randr_get_output_info_name(output));
 
         if (XCB_NONE != output->crtc) {
-            icookie = xcb_randr_get_crtc_info(dis, output->crtc, timestamp);
-            crtc    = xcb_randr_get_crtc_info_reply(dis, icookie, NULL);
+            crtc    = RECREPLY(xcb_randr_get_crtc_info_reply(dis, icookie[i], NULL));
 
-            if (NULL == crtc) 
-                return; 
+            if (NULL == crtc) {
+                free(output);
+                continue;
+            }
 
             flag = true;
 
@@ -1191,6 +3185,7 @@ void getoutputs(xcb_randr_output_t *outputs, const int len, xcb_timestamp_t time
                     mons = createmon(outputs[i], crtc->x, crtc->y, crtc->width, crtc->height, ++nmons);
                 }
             }
+            free(crtc);
         }
         else {
             //find monitor and delete
@@ -1201,6 +3196,12 @@ void getoutputs(xcb_randr_output_t *outputs, const int len, xcb_timestamp_t time
                     if (m == selmon)
                         selmon = mons;
                     DEBUG("getoutputs: deleting monitor\n");
+                    #if BAR
+                    if (m->bar) {
+                        xcb_destroy_window(dis, m->bar->win);
+                        free(m->bar);
+                    }
+                    #endif
                     free(m);
                     nmons--;
                     break;
@@ -1213,7 +3214,7 @@ void getoutputs(xcb_randr_output_t *outputs, const int len, xcb_timestamp_t time
 
 void getrandr(void) { // Get RANDR resources and figure out how many outputs there are.
     xcb_randr_get_screen_resources_current_cookie_t rcookie = xcb_randr_get_screen_resources_current(dis, screen->root);
-    xcb_randr_get_screen_resources_current_reply_t *res = xcb_randr_get_screen_resources_current_reply(dis, rcookie, NULL);
+    xcb_randr_get_screen_resources_current_reply_t *res = RECREPLY(xcb_randr_get_screen_resources_current_reply(dis, rcookie, NULL));
     if (NULL == res) return;
     xcb_timestamp_t timestamp = res->config_timestamp;
     int len     = xcb_randr_get_screen_resources_current_outputs_length(res);
@@ -1221,10 +3222,18 @@ void getrandr(void) { // Get RANDR resources and figure out how many outputs the
     /* Request information for all outputs. */
     getoutputs(outputs, len, timestamp);
     free(res);
-}
-
+    #if BAR
+    if (atlas.pmap)
+        updatebars();
+    #endif
+    #if MENU
+    if (openmenu) // it may be on a monitor that is gone, fitmenu() on the next launch
+        closemenu();
+    #endif
+}
+
 bool getrootptr(int *x, int *y) {
-    xcb_query_pointer_reply_t *reply = xcb_query_pointer_reply(dis, xcb_query_pointer(dis, screen->root), NULL);
+    xcb_query_pointer_reply_t *reply = RECREPLY(xcb_query_pointer_reply(dis, xcb_query_pointer(dis, screen->root), NULL));
 
     *x = reply->root_x;
     *y = reply->root_y;
@@ -1237,16 +3246,16 @@ bool getrootptr(int *x, int *y) {
 // set the given client to listen to button events (presses / releases)
 void grabbuttons(client *c) {
     unsigned int i, j, modifiers[] = { 0, XCB_MOD_MASK_LOCK, numlockmask, numlockmask|XCB_MOD_MASK_LOCK }; 
-    xcb_ungrab_button(dis, XCB_BUTTON_INDEX_ANY, c->win, XCB_GRAB_ANY);
+    xb->ungrabbutton(XCB_BUTTON_INDEX_ANY, c->win, XCB_GRAB_ANY);
     for(i = 0; i < LENGTH(buttons); i++)
         for(j = 0; j < LENGTH(modifiers); j++)
             #if CLICK_TO_FOCUS
-            xcb_grab_button(dis, false, c->win, BUTTONMASK, XCB_GRAB_MODE_SYNC,
+            xb->grabbutton(false, c->win, BUTTONMASK, XCB_GRAB_MODE_SYNC,
                                 XCB_GRAB_MODE_ASYNC, XCB_WINDOW_NONE, XCB_CURSOR_NONE,
                                 XCB_BUTTON_INDEX_ANY, XCB_BUTTON_MASK_ANY);
     
             #else
-            xcb_grab_button(dis, false, c->win, BUTTONMASK, XCB_GRAB_MODE_SYNC,
+            xb->grabbutton(false, c->win, BUTTONMASK, XCB_GRAB_MODE_SYNC,
                                 XCB_GRAB_MODE_ASYNC, XCB_WINDOW_NONE, XCB_CURSOR_NONE,
                                 buttons[i].button, buttons[i].mask | modifiers[j]);
             #endif
@@ -1256,12 +3265,13 @@ void grabbuttons(client *c) {
 void grabkeys(void) {
     xcb_keycode_t *keycode;
     unsigned int modifiers[] = { 0, XCB_MOD_MASK_LOCK, numlockmask, numlockmask|XCB_MOD_MASK_LOCK };
-    xcb_ungrab_key(dis, XCB_GRAB_ANY, screen->root, XCB_MOD_MASK_ANY);
+    xb->ungrabkey(XCB_GRAB_ANY, screen->root, XCB_MOD_MASK_ANY);
     for (unsigned int i=0; i<LENGTH(keys); i++) {
         keycode = xcb_get_keycodes(keys[i].keysym);
         for (unsigned int k=0; keycode[k] != XCB_NO_SYMBOL; k++)
             for (unsigned int m=0; m<LENGTH(modifiers); m++)
-                xcb_grab_key(dis, 1, screen->root, keys[i].mod | modifiers[m], keycode[k], XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC);
+                xb->grabkey(1, screen->root, keys[i].mod | modifiers[m], keycode[k], XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC);
+        free(keycode);
     }
 }
 
@@ -1270,32 +3280,18 @@ void initializexresources() {
     //we should also go ahead and intitialize all the font gc's
     uint32_t            value_list[3];
     uint32_t            gcvalues[2];
-    xcb_void_cookie_t   cookie_font;
-    xcb_void_cookie_t   cookie_gc;
+    xcb_void_cookie_t   cookie_font, cookie_close;
+    xcb_void_cookie_t   cookie_gc[12];
     xcb_generic_error_t *error;
     xcb_font_t          font;
     uint32_t            mask, font_mask;
     xcb_drawable_t      win = screen->root;
-    XrmValue value;
-    char *str_type[20];
-    char buffer[20];
-    char *names[] = { "*color1", "*color2",  "*color3", "*color4", "*color5", "*color6", 
-                    "*color9", "*color10", "*color11", "*color12", "*color13", "*color14", NULL };
-    char *class[] = { "*Color1", "*Color2",  "*Color3", "*Color4", "*Color5", "*Color6", 
-                    "*Color9", "*Color10", "*Color11", "*Color12", "*Color13", "*Color14", NULL };
-    struct passwd *pw = getpwuid(getuid());
-    char *xdefaults = pw->pw_dir;
-    strcat(xdefaults, "/.Xdefaults");
 
     // initialize font
     // TODO: user font
-    font = xcb_generate_id (dis);
+    font = xb->id();
+    // every request is sent first and checked at the end, one round trip
     cookie_font = xcb_open_font_checked (dis, font, strlen ("7x13"), "7x13");
-    error = xcb_request_check (dis, cookie_font);
-    if (error) {
-        fprintf (stderr, "ERROR: can't open font : %d\n", error->error_code);
-        xcb_disconnect (dis);
-    }
 
     // initialize some values used to get the font gc's
     font_mask = XCB_GC_FOREGROUND | XCB_GC_BACKGROUND | XCB_GC_FONT;
@@ -1305,50 +3301,66 @@ void initializexresources() {
     mask = XCB_GC_FOREGROUND | XCB_GC_GRAPHICS_EXPOSURES;
     gcvalues[1] = 0;
 
-    // initialize Xresources
-    XrmInitialize();
-    XrmDatabase dbase = XrmGetFileDatabase(xdefaults);
-
+    // the colors were read by loadcolors(), make the gc's
     for(int i = 0; i < 12; i++) {
-        // now get all the colors from xresources and make the gc's
-        if (XrmGetResource(dbase, names[i], class[i], str_type, &value)) {
-            // getting color
-            strncpy(buffer, value.addr, (int) value.size);
-            xres.color[i] = getcolor(buffer);
-            
-            // getting rectangle foreground colors
-            xres.gc_color[i] = xcb_generate_id(dis);
-            gcvalues[0] = xres.color[i];
-            xcb_create_gc (dis, xres.gc_color[i], win, mask, gcvalues);
-            
-            // getting font gc
-            xres.font_gc[i] = xcb_generate_id(dis);
-            value_list[1] = xres.color[i];
-            cookie_gc = xcb_create_gc_checked (dis, xres.font_gc[i], win, font_mask, value_list);
-            error = xcb_request_check (dis, cookie_gc);
-            if (error) {
-                fprintf (stderr, "ERROR: can't create gc : %d\n", error->error_code);
-                xcb_disconnect (dis);
-                exit (-1);
-            } 
-        }
+        // getting rectangle foreground colors
+        xres.gc_color[i] = xb->id();
+        gcvalues[0] = xres.color[i];
+        xcb_create_gc (dis, xres.gc_color[i], win, mask, gcvalues);
+        
+        // getting font gc
+        xres.font_gc[i] = xb->id();
+        value_list[1] = xres.color[i];
+        cookie_gc[i] = xcb_create_gc_checked (dis, xres.font_gc[i], win, font_mask, value_list);
     } 
 
-    cookie_font = xcb_close_font_checked (dis, font);
-    error = xcb_request_check (dis, cookie_font);
+    // gc's to clear and to copy the prerendered menus
+    xres.gc_clear = xb->id();
+    gcvalues[0] = screen->black_pixel;
+    xb->gc(xres.gc_clear, win, mask, gcvalues);
+    xres.gc_copy = xb->id();
+    xb->gc(xres.gc_copy, win, XCB_GC_GRAPHICS_EXPOSURES, &gcvalues[1]);
+    xres.gc_text = xb->id();
+    value_list[0] = screen->white_pixel;
+    value_list[1] = screen->black_pixel;
+    xb->gc(xres.gc_text, win, font_mask, value_list);
+
+    cookie_close = xcb_close_font_checked (dis, font);
+
+    // the last request first, only that one has to wait for the server
+    error = XREPLY(xcb_request_check (dis, cookie_close));
     if (error) {
         fprintf (stderr, "ERROR: can't close font : %d\n", error->error_code);
         xcb_disconnect (dis);
         exit (-1);
     }
+    error = XREPLY(xcb_request_check (dis, cookie_font));
+    if (error) {
+        fprintf (stderr, "ERROR: can't open font : %d\n", error->error_code);
+        xcb_disconnect (dis);
+        exit (-1);
+    }
+    for(int i = 0; i < 12; i++)
+        if ((error = XREPLY(xcb_request_check (dis, cookie_gc[i])))) {
+            fprintf (stderr, "ERROR: can't create gc : %d\n", error->error_code);
+            xcb_disconnect (dis);
+            exit (-1);
+        }
 }
 #endif
 
 // on the press of a key check to see if there's a binded function to call
 void keypress(xcb_generic_event_t *e) {
     xcb_key_press_event_t *ev       = (xcb_key_press_event_t *)e;
-    xcb_keysym_t           keysym   = xcb_get_keysym(ev->detail);
+    xcb_keysym_t           keysym   = xcb_get_keysym(ev->detail, 0);
     DEBUGP("xcb: keypress: code: %d mod: %d\n", ev->detail, ev->state);
+    #if MENU
+    if (openmenu && ev->event == openmenu->win) { // typed into the search, Shift counts
+        xcb_keysym_t shifted = ev->state & XCB_MOD_MASK_SHIFT ? xcb_get_keysym(ev->detail, 1) : 0;
+        menukey(shifted ? shifted : keysym);
+        return;
+    }
+    #endif
     for (unsigned int i=0; i < LENGTH(keys); i++)
         if (keysym == keys[i].keysym && CLEANMASK(keys[i].mod) == CLEANMASK(ev->state) && keys[i].func)
                 keys[i].func(&keys[i].arg);
@@ -1360,9 +3372,9 @@ void killclient() {
     desktop *d = &desktops[selmon->curr_dtop];
     if (!d->current) return;
     xcb_icccm_get_wm_protocols_reply_t reply; unsigned int n = 0; bool got = false;
-    if (xcb_icccm_get_wm_protocols_reply(dis,
+    if (XREPLY(xcb_icccm_get_wm_protocols_reply(dis,
         xcb_icccm_get_wm_protocols(dis, d->current->win, wmatoms[WM_PROTOCOLS]),
-        &reply, NULL)) { // TODO: Handle error?
+        &reply, NULL))) { // TODO: Handle error?
         for(; n != reply.atoms_len; ++n) 
             if ((got = reply.atoms[n] == wmatoms[WM_DELETE_WINDOW])) 
                 break;
@@ -1372,15 +3384,46 @@ void killclient() {
     else xcb_kill_client(dis, d->current->win);
 }
 
+// read a resource as a string into buf, NULL if it is not set
+const char* xresource(XrmDatabase db, const char *name, const char *class, char *buf, size_t size) {
+    XrmValue value;
+    char *type;
+
+    if (!db || !XrmGetResource(db, name, class, &type, &value) || !value.addr)
+        return NULL;
+    snprintf(buf, size, "%.*s", (int)value.size, value.addr);
+    return buf;
+}
+
+// read the colors from ~/.Xdefaults, the border colors fall back to
+// config.h and the menu tiles to white. the file is parsed into a private
+// database each time so it can be called again for a reload
+void loadcolors(unsigned int *border, unsigned int *menu) {
+    const char *bnames[] = { "4wm.focus", "4wm.unfocus", "4wm.outer", "4wm.floating" };
+    const char *bclass[] = { "4wm.Focus", "4wm.Unfocus", "4wm.Outer", "4wm.Floating" };
+    const char *bdefault[] = { FOCUS, UNFOCUS, OTRBRDRCOL, FLTBRDCOL };
+    const char *names[] = { "*color1", "*color2",  "*color3", "*color4", "*color5", "*color6", 
+                            "*color9", "*color10", "*color11", "*color12", "*color13", "*color14" };
+    const char *class[] = { "*Color1", "*Color2",  "*Color3", "*Color4", "*Color5", "*Color6", 
+                            "*Color9", "*Color10", "*Color11", "*Color12", "*Color13", "*Color14" };
+    XrmDatabase db = XrmGetFileDatabase(xdefaults);
+    const char *color;
+    char buffer[64];
+
+    for (int i = 0; i < BORDER_COLORS; i++)
+        border[i] = getcolor((color = xresource(db, bnames[i], bclass[i], buffer, sizeof(buffer))) ? color : bdefault[i]);
+    for (int i = 0; i < 12; i++)
+        menu[i] = (color = xresource(db, names[i], class[i], buffer, sizeof(buffer))) ? getcolor(color) : screen->white_pixel;
+    if (db)
+        XrmDestroyDatabase(db);
+}
+
 #if MENU
+// show a menu, its window and contents were prepared by rendermenu() so
+// this is just a map, the drawing happens on expose.
+// clicks and keys are handled by the main loop, see menuclick()
 void launchmenu(const Arg *arg) {
-    xcb_drawable_t win;
-    xcb_generic_event_t *e;
-    uint32_t mask = 0;
-    uint32_t winvalues[1];
-    bool waitforevents = true, found = false; 
     Menu *m = NULL;
-    int i, x, y;
 
     //find which menu
     for (m = menus; m; m = m->next)
@@ -1388,189 +3431,920 @@ void launchmenu(const Arg *arg) {
             DEBUG("launchmenu: found menu\n");
             break;
         }
-    
-    // Create black (foreground) graphic context
-    win = screen->root; 
+    if (!m)
+        return;
+    if (openmenu)
+        closemenu();
+    fitmenu(m);
+    m->page = 0;
+    m->sel = -1;
+
+    xb->configure(m->win, XCB_MOVE|XCB_CONFIG_WINDOW_STACK_MODE,
+                         (uint32_t[]){ selmon->x, selmon->y, XCB_STACK_MODE_ABOVE });
+    xb->map(m->win);
+    xb->property(XCB_PROP_MODE_REPLACE, screen->root, netatoms[NET_ACTIVE], XCB_ATOM_WINDOW, 32, 1, &m->win);
+    xb->focus(XCB_INPUT_FOCUS_POINTER_ROOT, m->win, XCB_CURRENT_TIME);
+    openmenu = m;
+    // every key goes to the menu while it is open, even the bound ones. a
+    // menu that can't have the keyboard could not be closed with it
+    xcb_grab_keyboard_reply_t *grab = RECREPLY(xcb_grab_keyboard_reply(dis, xcb_grab_keyboard(dis, 0, m->win,
+                                                XCB_CURRENT_TIME, XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC), NULL));
+    if (!grab || grab->status != XCB_GRAB_STATUS_SUCCESS) {
+        DEBUG("launchmenu: cannot grab the keyboard\n");
+        free(grab);
+        closemenu();
+        return;
+    }
+    free(grab);
+    #if MENU_SEARCH
+    updatepathindex();
+    #endif
+}
+#endif
 
-    // Ask for our window's Id
-    win = xcb_generate_id(dis);
+// start a command in its own session with the signal state of a fresh
+// process. argv[0] comes from a cached $PATH lookup and posix_spawn()
+// saves copying the whole wm like fork() would. done is called from the
+// main loop once the child exits
+pid_t launch(const char **argv, const char *startupid, void (*done)(pid_t pid)) {
+    const char *path = resolvecmd(argv[0]);
+    char **env = environ, *var = NULL;
+    posix_spawnattr_t attr;
+    sigset_t set;
+    pid_t pid;
+    int e, n;
+
+    if (startupid) { // the same environment but for DESKTOP_STARTUP_ID
+        for (n = 0; environ[n]; n++);
+        env = (char**)malloc_safe((n + 2) * sizeof(char*));
+        var = (char*)malloc_safe(strlen(startupid) + sizeof("DESKTOP_STARTUP_ID="));
+        sprintf(var, "DESKTOP_STARTUP_ID=%s", startupid);
+        for (e = n = 0; environ[n]; n++)
+            if (strncmp(environ[n], "DESKTOP_STARTUP_ID=", 19))
+                env[e++] = environ[n];
+        env[e++] = var;
+        env[e] = NULL;
+    }
 
-    // Create the window
-    mask = XCB_CW_EVENT_MASK;
-    winvalues[0] = XCB_EVENT_MASK_EXPOSURE;
-    xcb_create_window (dis, XCB_COPY_FROM_PARENT, win, screen->root, selmon->x, 
-                        selmon->y, selmon->w, selmon->h, 0, XCB_WINDOW_CLASS_INPUT_OUTPUT, 
-                        screen->root_visual, mask, winvalues);
+    posix_spawnattr_init(&attr);
+    sigemptyset(&set);
+    posix_spawnattr_setsigmask(&attr, &set);
+    sigaddset(&set, SIGCHLD);
+    sigaddset(&set, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &set);
+    #ifdef POSIX_SPAWN_SETSID
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID|POSIX_SPAWN_SETSIGMASK|POSIX_SPAWN_SETSIGDEF);
+    #else
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP|POSIX_SPAWN_SETSIGMASK|POSIX_SPAWN_SETSIGDEF);
+    #endif
+    if (path)
+        e = posix_spawn(&pid, path, NULL, &attr, (char**)argv, env);
+    else // not on $PATH as far as we can tell, let posix_spawnp() have a go
+        e = posix_spawnp(&pid, argv[0], NULL, &attr, (char**)argv, env);
+    posix_spawnattr_destroy(&attr);
+    if (startupid) {
+        free(env);
+        free(var);
+    }
+    if (e) {
+        fprintf(stderr, "error: posix_spawn %s failed: %s\n", argv[0], strerror(e));
+        return -1;
+    }
+    DEBUGP("launch: %s pid %d\n", path ? path : argv[0], pid);
+    trackchild(pid, done);
+    return pid;
+}
 
-    // Map the window on the screen
-    xcb_map_window (dis, win);
-     
-    xcb_change_property(dis, XCB_PROP_MODE_REPLACE, screen->root, netatoms[NET_ACTIVE], XCB_ATOM_WINDOW, 32, 1, &win);
-    xcb_set_input_focus(dis, XCB_INPUT_FOCUS_POINTER_ROOT, win, XCB_CURRENT_TIME);
-    
-    // We flush the request
-    xcb_flush (dis);
+#if LAYOUTS
+// where the layout name is kept, $XDG_CONFIG_HOME/4wm/layouts/name
+bool layoutpath(const char *name, char *path, size_t size) {
+    char *config = getenv("XDG_CONFIG_HOME"), *home = getenv("HOME");
 
-    while (waitforevents && (e = xcb_wait_for_event (dis))) {
-        switch (e->response_type & ~0x80) {
-            case XCB_EXPOSE: {
-                DEBUG("launchmenu: entering XCB_EXPOSE\n");
-                // loop through menu_entries
-                i = 0;
-                for (Menu_Entry *mentry = m->head; mentry; mentry = mentry->next) {
-                    DEBUG("launchmenu: drawing iteration\n");
-                    // We draw the rectangles
-                    xcb_poly_fill_rectangle(dis, win, xres.gc_color[i], 1, mentry->rectangles);
-                    // we also want to draw the command/program
-                    text_draw(xres.font_gc[i], win, mentry->x + 10, mentry->y + 30, mentry->cmd[0]);
-                    if (i == 11) i = 0;
-                    else i++;
-                }
-                // We flush the request
-                xcb_flush (dis);
-                break;
-            }
-            case XCB_BUTTON_PRESS: {
-                DEBUG("launchmenu: entering XCB_BUTTON_PRESS\n");
-                waitforevents = false;
-                xcb_unmap_window (dis, win);
-                if (getrootptr(&x, &y)) {
-                x -= selmon->x;
-                y -= selmon->y;
-                DEBUGP("launchmenu: x %d y %d\n", x, y);
-                    for (Menu_Entry *mentry = m->head; mentry; ) {
-                        DEBUGP("launchmenu: mentry->x %d mentry->y %d\n", mentry->x, mentry->y);
-                        if (INRECT(x, y, mentry->x, mentry->y, 100, 60)) { 
-                            found = true;
-                            if (fork()) return;
-                            if (dis) close(screen->root);
-                            setsid();
-                            execvp(mentry->cmd[0], mentry->cmd);
-                            break; // exit loop
-                        }
-                        
-                        if (x < mentry->x) {
-                            if (!mentry->l) break;
-                            else mentry = mentry->l;
-                        } else if (x > mentry->x + 100) { 
-                            if (!mentry->r) break;
-                            else mentry = mentry->r;
-                        }
-                        
-                        if (y < mentry->y) {
-                            if (!mentry->t) break;
-                            else mentry = mentry->t;
-                        } else if (y > mentry->y + 60) {
-                            if (!mentry->b) break;
-                            else mentry = mentry->b;
-                        }
-                    }
-                }
-    
-                if (!found)
-                    focus(desktops[selmon->curr_dtop].current, &desktops[selmon->curr_dtop], selmon);
+    if (config && *config)
+        snprintf(path, size, "%s/4wm/layouts/%s", config, name);
+    else if (home)
+        snprintf(path, size, "%s/.config/4wm/layouts/%s", home, name);
+    else
+        return false;
+    return true;
+}
 
-                break;
-            }
-            case XCB_KEY_RELEASE: {
-                DEBUG("launchmenu: entering XCB_KEY_RELEASE\n");
-                break; 
-            }
-            default: {
-                DEBUG("launchmenu: unknown event\n");
-                // Unknown event type, ignore it
-                break;
+// read a layout saved by savelayout(), a line of xp yp wp hp class for each
+// tile. returns the number of tiles, the caller frees *slots
+int loadlayout(const char *name, layoutslot **slots) {
+    char path[PATH_MAX], line[128];
+    int n = 0, max = 0;
+    FILE *f;
+
+    *slots = NULL;
+    if (!layoutpath(name, path, sizeof(path)) || !(f = fopen(path, "r"))) {
+        warnx("no layout %s", name);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        layoutslot s = { .class = "" };
+        if (sscanf(line, "%d %d %d %d %63[^\n]", &s.xp, &s.yp, &s.wp, &s.hp, s.class) < 4
+            || s.xp < 0 || s.yp < 0 || s.wp <= 0 || s.hp <= 0 || s.xp + s.wp > 100 || s.yp + s.hp > 100)
+            continue;
+        if (n == max && !(*slots = realloc(*slots, (max = max ? 2 * max : 8) * sizeof(layoutslot))))
+            err(EXIT_FAILURE, "cannot allocate layout");
+        (*slots)[n++] = s;
+    }
+    fclose(f);
+    return n;
+}
+#endif
+
+// fnv-1a, to fold $PATH and directory mtimes or a layout into a signature
+uint64_t fnv(uint64_t h, const void *data, size_t len) {
+    for (const unsigned char *p = data; len--; p++)
+        h = (h ^ *p) * 1099511628211ULL;
+    return h;
+}
+
+#if MENU_SEARCH
+// call f for every directory in $PATH, in order
+void forpathdirs(void (*f)(const char *dir, int i, void *arg), void *arg) {
+    char *path = getenv("PATH"), dir[PATH_MAX];
+    int i = 0;
+
+    for (const char *p = path ? path : ""; *p; ) {
+        size_t n = strcspn(p, ":");
+        if (n && n < sizeof(dir)) {
+            memcpy(dir, p, n);
+            dir[n] = '\0';
+            f(dir, i++, arg);
+        }
+        p += n + (p[n] == ':');
+    }
+}
+
+void signdir(const char *dir, int i, void *arg) {
+    uint64_t *h = arg;
+    struct stat st;
+
+    (void)i;
+    *h = fnv(*h, dir, strlen(dir) + 1);
+    if (stat(dir, &st) == 0)
+        *h = fnv(*h, &st.st_mtim, sizeof(st.st_mtim));
+}
+
+// the signature of $PATH as it is now, one stat() per directory
+uint64_t pathsignature(void) {
+    uint64_t h = 14695981039346656037ULL;
+    forpathdirs(signdir, &h);
+    return h;
+}
+
+typedef struct {
+    char *name;
+    int dir;                    // index of the directory in $PATH
+    uint32_t launches;
+} pathscan;
+
+typedef struct {
+    pathscan *ents;
+    size_t n, max;
+    char **dirs;
+    int ndirs;
+} pathscanlist;
+
+void scanpathdir(const char *dir, int i, void *arg) {
+    pathscanlist *l = arg;
+    char file[PATH_MAX];
+    struct dirent *de;
+    struct stat st;
+    DIR *dp;
+
+    l->dirs = realloc(l->dirs, (i + 1) * sizeof(char*));
+    l->dirs[i] = strdup(dir);
+    l->ndirs = i + 1;
+    if (!(dp = opendir(dir)))
+        return;
+    while ((de = readdir(dp))) {
+        if (de->d_name[0] == '.')
+            continue;
+        snprintf(file, sizeof(file), "%s/%s", dir, de->d_name);
+        if (stat(file, &st) < 0 || !S_ISREG(st.st_mode) || !(st.st_mode & 0111))
+            continue;
+        if (l->n == l->max)
+            l->ents = realloc(l->ents, (l->max = l->max ? 2 * l->max : 1024) * sizeof(pathscan));
+        l->ents[l->n++] = (pathscan){ .name = strdup(de->d_name), .dir = i };
+    }
+    closedir(dp);
+}
+
+// sort by name, the first directory in $PATH wins like in execvp()
+int pathscancmp(const void *a, const void *b) {
+    const pathscan *x = a, *y = b;
+    int r = strcmp(x->name, y->name);
+    return r ? r : x->dir - y->dir;
+}
+
+// scan $PATH and write a new index file, runs in the 4wm -P that
+// updatepathindex() launched. launch counts are carried over from the old
+// index, both are sorted by name so that is a merge
+void buildpathindex(uint64_t signature) {
+    pathscanlist l = { 0 };
+    char tmp[PATH_MAX + 8];
+    uint32_t count = 0, off = 0, *diroff;
+    size_t i, o = 0;
+    FILE *f;
+
+    forpathdirs(scanpathdir, &l);
+    qsort(l.ents, l.n, sizeof(pathscan), pathscancmp);
+    for (i = 0; i < l.n; i++) {
+        if (count && !strcmp(l.ents[count - 1].name, l.ents[i].name))
+            continue;
+        l.ents[count] = l.ents[i];
+        for (; pindex.hdr && o < pindex.hdr->count && strcmp(pindex.strings + pindex.entries[o].name, l.ents[count].name) < 0; o++);
+        if (pindex.hdr && o < pindex.hdr->count && !strcmp(pindex.strings + pindex.entries[o].name, l.ents[count].name))
+            l.ents[count].launches = pindex.entries[o].launches;
+        count++;
+    }
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", pindex.file);
+    if (!(f = fopen(tmp, "w")))
+        return;
+    fwrite(&(pathindexhdr){ .magic = PATHINDEX_MAGIC, .count = count, .signature = signature }, sizeof(pathindexhdr), 1, f);
+    diroff = malloc_safe((l.ndirs + 1) * sizeof(uint32_t));
+    for (int d = 0; d < l.ndirs; d++) {
+        diroff[d] = off;
+        off += strlen(l.dirs[d]) + 1;
+    }
+    for (i = 0; i < count; i++) {
+        uint32_t len = strlen(l.ents[i].name);
+        fwrite(&(pathentry){ .name = off, .dir = diroff[l.ents[i].dir], .len = len, .launches = l.ents[i].launches },
+               sizeof(pathentry), 1, f);
+        off += len + 1;
+    }
+    for (int d = 0; d < l.ndirs; d++)
+        fwrite(l.dirs[d], strlen(l.dirs[d]) + 1, 1, f);
+    for (i = 0; i < count; i++)
+        fwrite(l.ents[i].name, strlen(l.ents[i].name) + 1, 1, f);
+    if (fclose(f) == 0)
+        rename(tmp, pindex.file);
+    else
+        unlink(tmp);
+}
+
+// map the index file if it is new or was replaced by a rebuild
+void loadpathindex(void) {
+    struct stat st;
+    void *map;
+    int fd;
+
+    if ((fd = open(pindex.file, O_RDWR|O_CLOEXEC)) < 0)
+        return;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(pathindexhdr) ||
+        (pindex.hdr && st.st_ino == pindex.ino && !memcmp(&st.st_mtim, &pindex.mtime, sizeof(st.st_mtim)))) {
+        close(fd);
+        return;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return;
+    // the file may be cut short or garbage, every string has to end inside it
+    pathindexhdr *hdr = map;
+    pathentry *e = (pathentry*)(hdr + 1);
+    size_t strsize = 0;
+    bool ok = hdr->magic == PATHINDEX_MAGIC && ((char*)map)[st.st_size - 1] == '\0'
+           && sizeof(pathindexhdr) + (size_t)hdr->count * sizeof(pathentry) < (size_t)st.st_size;
+    if (ok)
+        strsize = st.st_size - sizeof(pathindexhdr) - (size_t)hdr->count * sizeof(pathentry);
+    for (uint32_t i = 0; ok && i < hdr->count; i++)
+        ok = e[i].name < strsize && e[i].dir < strsize && e[i].len < strsize - e[i].name;
+    if (!ok) {
+        munmap(map, st.st_size);
+        return;
+    }
+
+    // launches counted in the old mapping while the new index was built
+    const char *strings = (char*)(e + hdr->count);
+    for (uint32_t i = 0, o = 0; pindex.hdr && i < hdr->count; i++) {
+        for (; o < pindex.hdr->count && strcmp(pindex.strings + pindex.entries[o].name, strings + e[i].name) < 0; o++);
+        if (o < pindex.hdr->count && !strcmp(pindex.strings + pindex.entries[o].name, strings + e[i].name)
+            && pindex.entries[o].launches > e[i].launches)
+            e[i].launches = pindex.entries[o].launches;
+    }
+    if (pindex.hdr)
+        munmap(pindex.hdr, pindex.size);
+    pindex.hdr = hdr;
+    pindex.size = st.st_size;
+    pindex.ino = st.st_ino;
+    pindex.mtime = st.st_mtim;
+    pindex.entries = (pathentry*)(hdr + 1);
+    pindex.strings = (char*)(pindex.entries + hdr->count);
+    pindex.cand = realloc(pindex.cand, (hdr->count + 1) * sizeof(uint32_t));
+    pindex.ncand = pindex.nresults = pindex.sel = 0;
+    DEBUGP("loadpathindex: %u executables\n", hdr->count);
+}
+
+// the rebuild runs in a fresh 4wm -P, a finished one is picked up here.
+// not a fork(), the reader thread may hold a lock malloc() needs
+void updatepathindex(void) {
+    uint64_t signature = pathsignature();
+
+    loadpathindex();
+    if ((pindex.hdr && pindex.hdr->signature == signature) || pindex.rebuild > 0)
+        return;
+    DEBUG("updatepathindex: rebuilding\n");
+    if ((pindex.rebuild = launch((const char*[]){ argv0, "-P", NULL }, NULL, pathindexbuilt)) < 0)
+        pindex.rebuild = 0;
+}
+
+// the rebuild finished, take the new index right away
+void pathindexbuilt(pid_t pid) {
+    (void)pid;
+    pindex.rebuild = 0;
+    loadpathindex();
+}
+
+// case insensitive match of the query against a name
+// 3 - prefix, 2 - substring, 1 - subsequence, 0 - no match
+int pathmatch(const char *name, const char *query, int qlen) {
+    const char *n, *q;
+    int i;
+
+    for (n = name, q = query; *q && *n; n++)
+        if (tolower((unsigned char)*n) == tolower((unsigned char)*q))
+            q++;
+    if (*q)
+        return 0;
+    for (n = name; *n; n++) {
+        for (i = 0; i < qlen && n[i] && tolower((unsigned char)n[i]) == tolower((unsigned char)query[i]); i++);
+        if (i == qlen)
+            return n == name ? 3 : 2;
+    }
+    return 1;
+}
+
+// rank the index against the query, with refine only the entries that
+// matched the previous query are looked at
+void searchpathindex(bool refine) {
+    uint32_t score[MENU_RESULTS], n = 0;
+    int k;
+
+    if (!refine || !pindex.ncand) {
+        for (pindex.ncand = 0; pindex.ncand < pindex.hdr->count; pindex.ncand++)
+            pindex.cand[pindex.ncand] = pindex.ncand;
+    }
+    pindex.nresults = pindex.sel = 0;
+    for (uint32_t i = 0; i < pindex.ncand; i++) {
+        pathentry *e = &pindex.entries[pindex.cand[i]];
+        int q = pathmatch(pindex.strings + e->name, pindex.query, pindex.qlen);
+        if (!q)
+            continue;
+        pindex.cand[n++] = pindex.cand[i];
+
+        // launch count first, then match quality, then shorter names
+        uint32_t sc = (e->launches > 0xFFFF ? 0xFFFF : e->launches) << 10 | q << 8 | (e->len > 255 ? 0 : 255 - e->len);
+        for (k = pindex.nresults; k > 0 && score[k - 1] < sc; k--)
+            if (k < MENU_RESULTS) {
+                score[k] = score[k - 1];
+                pindex.results[k] = pindex.results[k - 1];
             }
+        if (k < MENU_RESULTS) {
+            score[k] = sc;
+            pindex.results[k] = pindex.cand[i];
+            if (pindex.nresults < MENU_RESULTS)
+                pindex.nresults++;
         }
-        // Free the Generic Event
-        free (e);
     }
+    pindex.ncand = n;
+}
+
+// a key for the search, false if it is one for the menu itself.
+// the arrows and Return belong to the search once something was typed
+bool searchkey(xcb_keysym_t keysym) {
+    if (!pindex.hdr)
+        return false;
+    if (keysym == XK_Return && pindex.qlen) {
+        if (pindex.nresults) {
+            pathentry *e = &pindex.entries[pindex.results[pindex.sel]];
+            char cmd[PATH_MAX];
+
+            snprintf(cmd, sizeof(cmd), "%s/%s", pindex.strings + e->dir, pindex.strings + e->name);
+            e->launches++;
+            closemenu();
+            spawn(&(Arg){.com = (const char*[]){ cmd, NULL }});
+        }
+        return true;
+    } else if (keysym == XK_BackSpace && pindex.qlen) {
+        pindex.query[--pindex.qlen] = '\0';
+        searchpathindex(false);
+    } else if (keysym == XK_Up && pindex.qlen) {
+        if (pindex.sel > 0)
+            pindex.sel--;
+    } else if (keysym == XK_Down && pindex.qlen) {
+        if (pindex.sel + 1 < pindex.nresults)
+            pindex.sel++;
+    } else if (keysym >= ' ' && keysym <= '~' && pindex.qlen + 1 < (int)sizeof(pindex.query)) {
+        pindex.query[pindex.qlen++] = keysym;
+        pindex.query[pindex.qlen] = '\0';
+        searchpathindex(pindex.qlen > 1);
+    } else
+        return false;
+    drawsearch();
+    return true;
+}
+
+// draw the query and the results over the top left of the open menu,
+// or restore the menu there once the query is empty
+void drawsearch(void) {
+    const int lh = 16, w = 400, h = (MENU_RESULTS + 1) * lh + lh / 2;
+    char line[128];
+
+    if (!pindex.qlen) {
+        xb->copy(openmenu->pmaps[openmenu->page], openmenu->win, xres.gc_copy, 0, 0, 0, 0, w, h);
+        selectmenucell(openmenu, openmenu->sel);
+        return;
+    }
+    xb->fill(openmenu->win, xres.gc_clear, 1, &(xcb_rectangle_t){ 0, 0, w, h });
+    snprintf(line, sizeof(line), "run: %s_", pindex.query);
+    text_draw(xres.gc_text, openmenu->win, 8, lh, line);
+    for (int i = 0; i < pindex.nresults; i++) {
+        snprintf(line, sizeof(line), "%c %s", i == pindex.sel ? '>' : ' ', pindex.strings + pindex.entries[pindex.results[i]].name);
+        text_draw(xres.gc_text, openmenu->win, 8, (i + 2) * lh, line);
+    }
+}
+
+// the index lives in $XDG_CACHE_HOME/4wm/path.idx
+void setuppathindex(void) {
+    if (pathindexfile())
+        updatepathindex();
+}
+
+// where the index is kept, in pindex.file. false if there is no place
+bool pathindexfile(void) {
+    char *cache = getenv("XDG_CACHE_HOME"), *home = getenv("HOME"), dir[PATH_MAX];
+
+    if (cache && *cache)
+        snprintf(dir, sizeof(dir), "%s/4wm", cache);
+    else if (home)
+        snprintf(dir, sizeof(dir), "%s/.cache/4wm", home);
+    else
+        return false;
+    mkdir(dir, 0755);
+    if (snprintf(pindex.file, sizeof(pindex.file), "%s/path.idx", dir) >= (int)sizeof(pindex.file)) {
+        pindex.file[0] = '\0';
+        return false;
+    }
+    return true;
 }
 #endif
 
 void* malloc_safe(size_t size) {
     void *ret;
-    if(!(ret = malloc(size)))
-        puts("malloc_safe: fatal: could not malloc()");
+    COUNT(allocs);
+    if (!(ret = malloc(size))) { // abort() so a trace is written, see sigcrash()
+        warn("malloc_safe: cannot allocate %zu bytes", size);
+        abort();
+    }
     memset(ret, 0, size);
     return ret;
 }
 
+// resident set size and the bytes malloc() handed out and has not got back,
+// the latter only with glibc and 0 elsewhere
+void memusage(long *rss, size_t *heap) {
+    long pages = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+
+    if (f) {
+        if (fscanf(f, "%*d %ld", &pages) != 1)
+            pages = 0;
+        fclose(f);
+    }
+    *rss = pages * sysconf(_SC_PAGESIZE);
+    #if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    *heap = mallinfo2().uordblks;
+    #elif defined(__GLIBC__) // before mallinfo2(), the int wraps at 2GB but soak() takes a difference
+    *heap = (unsigned int)mallinfo().uordblks;
+    #else
+    *heap = 0;
+    #endif
+}
+
 void mappingnotify(xcb_generic_event_t *e) {
     xcb_mapping_notify_event_t *ev = (xcb_mapping_notify_event_t*)e;
-    //xcb_keysym_t           keysym   = xcb_get_keysym(ev->detail);
 
-    //xcb_refresh_keyboard_mapping(keysym, ev);
+    if (!keysyms) // a replay, the recording has the keysyms
+        return;
+    xcb_refresh_keyboard_mapping(keysyms, ev);
     if(ev->request == XCB_MAPPING_NOTIFY)
         grabkeys();
 }
 
-// a map request is received when a window wants to display itself
-// if the window has override_redirect flag set then it should not be handled
-// by the wm. if the window already has a client then there is nothing to do.
-//
-// get the window class and name instance and try to match against an app rule.
-// create a client for the window, that client will always be current.
-// check for transient state, and fullscreen state and the appropriate values.
-// if the desktop in which the window was spawned is the current desktop then
-// display the window, else, if set, focus the new desktop.
-void maprequest(xcb_generic_event_t *e) {
-    client *c = NULL; 
-    xcb_map_request_event_t            *ev = (xcb_map_request_event_t*)e;
-    xcb_window_t                       windows[] = { ev->window }, transient = 0;
-    xcb_get_window_attributes_reply_t  *attr[1];
-    xcb_ewmh_get_atoms_reply_t         type;
+// notes a request that may move a window under the pointer, see seqspan
+void layoutrequest(unsigned int seq) {
+    seqspan *s = &layoutspans[nlayoutspans % LAYOUT_SPANS];
 
-    xcb_get_attributes(windows, attr, 1);
-    if (!attr[0] || attr[0]->override_redirect) 
+    if (!layoutopen) {
+        s->first = seq;
+        layoutopen = true;
+    }
+    s->last = seq;
+}
+
+/* closes the span of this batch. the no-op moves the sequence past it, so
+ * crossings the user makes from now on carry a number that isn't ours
+ */
+void endlayout(void) {
+    if (!layoutopen)
         return;
-    c = wintoclient(ev->window);
-    if (c) 
-        return; 
- 
-    desktop *d = &desktops[selmon->curr_dtop];
-    c = addwindow(ev->window, d);
-
-    xcb_icccm_get_wm_transient_for_reply(dis, xcb_icccm_get_wm_transient_for_unchecked(dis, ev->window), &transient, NULL); // TODO: error handling
-    c->istransient = transient?true:false;
-    if (xcb_ewmh_get_wm_window_type_reply(ewmh, xcb_ewmh_get_wm_window_type(ewmh, ev->window), &type, NULL) == 1) {
-        for (unsigned int i = 0; i < type.atoms_len; i++) {
-            xcb_atom_t a = type.atoms[i];
-            if (a == ewmh->_NET_WM_WINDOW_TYPE_SPLASH
-                || a == ewmh->_NET_WM_WINDOW_TYPE_DIALOG
-                || a == ewmh->_NET_WM_WINDOW_TYPE_DROPDOWN_MENU
-                || a == ewmh->_NET_WM_WINDOW_TYPE_POPUP_MENU
-                || a == ewmh->_NET_WM_WINDOW_TYPE_TOOLTIP
-                || a == ewmh->_NET_WM_WINDOW_TYPE_NOTIFICATION) {
-                c->istransient = true;
+    layoutopen = false;
+    nlayoutspans++;
+    expirespans(xcb_no_operation(dis).sequence);
+}
+
+// drop the closed spans more than 65535 requests behind seq, by the time
+// the sequence comes around to them again they mean nothing
+void expirespans(uint32_t seq) {
+    if (oldspans < nlayoutspans - LAYOUT_SPANS)
+        oldspans = nlayoutspans - LAYOUT_SPANS;
+    while (oldspans < nlayoutspans && (int32_t)(seq - layoutspans[oldspans % LAYOUT_SPANS].last) > 0xFFFF)
+        oldspans++;
+}
+
+// the full sequence xcb widened the event's 16 bits to is compared, so an
+// old span can't match a crossing by wrapping. a replayed crossing carries
+// what this said when it was recorded instead, see recordevent()
+bool ourcrossing(const xcb_generic_event_t *ev) {
+    if (replaying.f)
+        return ev->sequence != 0;
+    expirespans(ev->full_sequence);
+    int n = nlayoutspans + layoutopen;
+
+    for (int i = oldspans > n - LAYOUT_SPANS ? oldspans : n - LAYOUT_SPANS; i < n; i++) {
+        const seqspan *s = &layoutspans[i % LAYOUT_SPANS];
+        if (ev->full_sequence - s->first <= s->last - s->first)
+            return true;
+    }
+    return false;
+}
+
+/* -l, keeps keys and focus responsive on a saturated machine. asks for a
+ * realtime policy, else for a lower nice value, either reset for spawned
+ * children. then locks 4wm in memory and touches the heap, the pools and
+ * the stack now, so no handler waits on a page fault later. what took
+ * effect goes to stats.latency and is warned about if it fell short
+ */
+void lowlatency(void) {
+    struct sched_param sp = { .sched_priority = LATENCY_PRIORITY };
+    struct rlimit rl;
+    char *heap;
+
+    if (sched_setscheduler(0, SCHED_FIFO | SCHED_RESET_ON_FORK, &sp) == 0)
+        stats.latency |= LATENCY_REALTIME;
+    else if (setpriority(PRIO_PROCESS, 0, LATENCY_NICE_VALUE) == 0) {
+        sp.sched_priority = 0;
+        sched_setscheduler(0, SCHED_OTHER | SCHED_RESET_ON_FORK, &sp);
+        stats.latency |= LATENCY_NICE;
+    } else
+        warn("low latency: cannot raise the priority");
+
+    // locking future pages past RLIMIT_MEMLOCK would make malloc fail
+    getrlimit(RLIMIT_MEMLOCK, &rl);
+    if ((rl.rlim_cur == RLIM_INFINITY || geteuid() == 0) && mlockall(MCL_CURRENT | MCL_FUTURE) == 0)
+        stats.latency |= LATENCY_LOCKED | LATENCY_LOCKFUTURE;
+    else if (mlockall(MCL_CURRENT) == 0)
+        stats.latency |= LATENCY_LOCKED;
+    else
+        warn("low latency: cannot lock memory");
+
+    // keep what was touched in the heap instead of giving it back
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    if ((heap = malloc(LATENCY_HEAP))) {
+        for (size_t i = 0; i < LATENCY_HEAP; i += 4096)
+            heap[i] = 0;
+        free(heap);
+        stats.latency |= LATENCY_PREFAULTED;
+    }
+    poolput(&clientpool, poolget(&clientpool));
+    #if MENU
+    poolput(&entrypool, poolget(&entrypool));
+    #endif
+    scratchalloc(SCRATCH_SIZE);
+    scratchreset();
+    prefaultstack();
+    if (!(stats.latency & LATENCY_REALTIME))
+        warnx("low latency: no realtime priority, %s", stats.latency & LATENCY_NICE ? "raised nice instead" : "running as usual");
+}
+
+void prefaultstack(void) {
+    char stack[LATENCY_STACK];
+    volatile char *p = stack;   // or the writes are dropped
+
+    for (size_t i = 0; i < LATENCY_STACK; i += 4096)
+        p[i] = 0;
+}
+
+// take over a batch of windows, as one burst so every affected tile is
+// configured once and focus moves once, to the last window that landed on
+// the shown desktop. all requests go out before any reply is waited for
+// desks, if given, has the desktop each window goes to, see adopt()
+void manage(xcb_window_t *wins, const int *desks, int n) {
+    xcb_get_window_attributes_cookie_t attrcookie[n];
+    xcb_get_property_cookie_t          pidcookie[n], transcookie[n], typecookie[n];
+    #if LAYOUTS
+    xcb_get_property_cookie_t          classcookie[n];
+    #endif
+    #if RESERVE_SLOTS
+    xcb_get_property_cookie_t          idcookie[n];
+    xcb_ewmh_get_utf8_strings_reply_t  id;
+    slot                               *s;
+    #endif
+    xcb_get_window_attributes_reply_t  *attr;
+    xcb_ewmh_get_atoms_reply_t         type;
+    xcb_window_t                       transient;
+    uint32_t                           wmpid;
+    client *c, *target, *focused = NULL, *touched[2 * n];
+    int i, t, ntouched = 0, bucket, touchdesk[2 * n];
+    bool remonocle[DESKTOPS] = { false }, reshown[DESKTOPS] = { false };
+    int64_t start = tracing ? ustime() : 0;
+
+    for (i = 0; i < n; i++) {
+        attrcookie[i]  = xcb_get_window_attributes(dis, wins[i]);
+        pidcookie[i]   = xcb_ewmh_get_wm_pid_unchecked(ewmh, wins[i]);
+        #if RESERVE_SLOTS
+        idcookie[i]    = xcb_ewmh_get_startup_id_unchecked(ewmh, wins[i]);
+        #endif
+        transcookie[i] = xcb_icccm_get_wm_transient_for_unchecked(dis, wins[i]);
+        typecookie[i]  = xcb_ewmh_get_wm_window_type_unchecked(ewmh, wins[i]);
+        #if LAYOUTS
+        classcookie[i] = xcb_icccm_get_wm_class_unchecked(dis, wins[i]);
+        #endif
+    }
+
+    for (i = 0; i < n; i++) {
+        // a replay on the fake backend has its windows there, no server answers
+        const fakewin *fw = xb == &fakebackend ? fakewindow(wins[i]) : NULL;
+        attr = XREPLY(xcb_get_window_attributes_reply(dis, attrcookie[i], NULL));
+        if ((!fw && (!attr || attr->override_redirect)) || wintoclient(wins[i])) {
+            free(attr);
+            xcb_discard_reply(dis, pidcookie[i].sequence);
+            #if RESERVE_SLOTS
+            xcb_discard_reply(dis, idcookie[i].sequence);
+            #endif
+            xcb_discard_reply(dis, transcookie[i].sequence);
+            xcb_discard_reply(dis, typecookie[i].sequence);
+            #if LAYOUTS
+            xcb_discard_reply(dis, classcookie[i].sequence);
+            #endif
+            continue;
+        }
+        free(attr);
+
+        desktop *d = &desktops[desks ? desks[i] : selmon->curr_dtop];
+        if (XREPLY(xcb_ewmh_get_wm_pid_reply(ewmh, pidcookie[i], &wmpid, NULL)) != 1)
+            wmpid = 0;
+        target = NULL;
+        #if RESERVE_SLOTS
+        // launched with a reserved slot, go to its desktop and split its tile
+        id.strings = NULL;
+        XREPLY(xcb_ewmh_get_startup_id_reply(ewmh, idcookie[i], &id, NULL));
+        if ((s = takeslot(wmpid, id.strings, id.strings ? id.strings_len : 0))) {
+            DEBUGP("manage: reserved slot on desktop %d\n", s->desktop);
+            d = &desktops[s->desktop];
+            for (target = d->head; target && target->win != s->target; target = target->next);
+        }
+        if (id.strings)
+            xcb_ewmh_get_utf8_strings_reply_wipe(&id);
+        #endif
+        monitor *m;
+        for (m = mons; m && &desktops[m->curr_dtop] != d; m = m->next);
+
+        c = addwindow(wins[i], d);
+        if (target)
+            d->prevfocus = target;
+        if ((c->pid = wmpid))
+            for (t = 0; t < nprocs; t++)
+                if (procs[t].pid == c->pid && !procs[t].win) {
+                    DEBUGP("manage: window of launched pid %d\n", c->pid);
+                    procs[t].win = c->win;
+                }
+
+        transient = fw ? fw->transient : 0;
+        XREPLY(xcb_icccm_get_wm_transient_for_reply(dis, transcookie[i], &transient, NULL));
+        c->istransient = transient?true:false;
+        if (XREPLY(xcb_ewmh_get_wm_window_type_reply(ewmh, typecookie[i], &type, NULL)) == 1) {
+            c->istransient |= transienttype(type.atoms, type.atoms_len);
+            xcb_ewmh_get_atoms_reply_wipe(&type);
+        } else if (fw)
+            c->istransient |= transienttype(fw->types, fw->ntypes);
+        c->isfloating  = d->mode == FLOAT || c->istransient;
+        #if LAYOUTS
+        bool slotted = fillslot(c, d - desktops, classcookie[i]);
+        #endif
+
+        if (c->isfloating) {
+            const monitor *f = m ? m : selmon;
+            c->x = f->x + f->w / 4;
+            c->y = f->y + f->h / 4;
+            c->w = f->w / 2;
+            c->h = f->h / 2;
+        }
+        #if LAYOUTS
+        else if (slotted) // an applied layout kept a tile for it
+            d->count++;
+        #endif
+        else if (++d->count == 1) { // only the percentages, configured below
+            c->xp = 0; c->yp = 0; c->wp = 100; c->hp = 100;
+            geomtile(d, c);
+        } else {
+            client *o = d->prevfocus;
+            if (o->isfloating)
+                o = clientbehindfloater(d);
+            splitwindows(c, o, d, NULL);
+            for (t = 0; t < ntouched && touched[t] != o; t++);
+            if (t == ntouched) {
+                touchdesk[ntouched] = d - desktops;
+                touched[ntouched++] = o;
             }
         }
-        xcb_ewmh_get_atoms_reply_wipe(&type);
+        touchdesk[ntouched] = d - desktops;
+        touched[ntouched++] = c;
+        grabbuttons(c);
+        #if STATUS
+        c->titlestale = true; // fetched along with the other titles
+        #endif
+        if (m == selmon)
+            focused = c;
     }
-    c->isfloating  = d->mode == FLOAT || c->istransient;
 
-    if (c->isfloating) {
-        c->x = selmon->x + selmon->w / 4;
-        c->y = selmon->y + selmon->h / 4;
-        c->w = selmon->w / 2;
-        c->h = selmon->h / 2;
-    } 
- 
-    tilenew(d->current, d->prevfocus, d, selmon); 
-    xcb_map_window(dis, c->win);
-        
-    if(c->istransient)
-        retile(d, selmon); 
+    // one configure for every window whose tile changed
+    for (t = 0; t < ntouched; t++) {
+        desktop *d = &desktops[touchdesk[t]];
+        monitor *m;
+        c = touched[t];
+        for (m = mons; m && m->curr_dtop != touchdesk[t]; m = m->next);
+        if (!m) { // the desktop is not shown, it is tiled when it is
+            xb->unmap(c->win); // an adopted window may be mapped
+            continue;
+        }
+        if (ISFT(c)) {
+            xcb_move_resize(c, d, m);
+            xcb_raise_window(c->win);
+            reshown[touchdesk[t]] |= c->istransient; // retiled below, as a transient always was
+        } else if (d->mode == MONOCLE || d->mode == VIDEO)
+            remonocle[touchdesk[t]] = true;
+        else {
+            SETWINDOW(c, d, m);
+            xcb_move_resize(c, d, m);
+            xcb_lower_window(c->win);
+        }
+        xb->map(c->win);
+    }
+    for (monitor *m = mons; m; m = m->next) {
+        if (remonocle[m->curr_dtop])
+            monocle(&desktops[m->curr_dtop], m);
+        if (reshown[m->curr_dtop])
+            retile(&desktops[m->curr_dtop], m);
+    }
 
-    focus(c, d, selmon);
-     
-    grabbuttons(c);
-    
-    #if PRETTY_PRINT
-    updatetitle(c);
-    desktopinfo();
+    if (focused)
+        focus(focused, &desktops[selmon->curr_dtop], selmon);
+    TRACE(TP_MANAGE, n ? wins[0] : 0, 0, start, n);
+    if (ntouched) {
+        for (t = 0, bucket = 0; t < MAPBURST_BUCKETS - 1 && n >> (t + 1); t++, bucket++);
+        stats.mapbursts[bucket]++;
+        if ((unsigned long)n > stats.mapburstmax)
+            stats.mapburstmax = n;
+        DEBUGP("manage: %d windows, %d configured\n", n, ntouched);
+        #if PRETTY_PRINT
+        desktopinfo();
+        #endif
+    }
+}
+
+// whether a window of one of these types is kept out of the tiles
+bool transienttype(const xcb_atom_t *types, unsigned int n) {
+    for (unsigned int j = 0; j < n; j++) {
+        xcb_atom_t a = types[j];
+        if (a == ewmh->_NET_WM_WINDOW_TYPE_SPLASH
+            || a == ewmh->_NET_WM_WINDOW_TYPE_DIALOG
+            || a == ewmh->_NET_WM_WINDOW_TYPE_DROPDOWN_MENU
+            || a == ewmh->_NET_WM_WINDOW_TYPE_POPUP_MENU
+            || a == ewmh->_NET_WM_WINDOW_TYPE_TOOLTIP
+            || a == ewmh->_NET_WM_WINDOW_TYPE_NOTIFICATION)
+            return true;
+    }
+    return false;
+}
+
+// queue the window, it is managed with the rest of the batch in commit()
+void maprequest(xcb_generic_event_t *e) {
+    xcb_map_request_event_t *ev = (xcb_map_request_event_t*)e;
+
+    for (int i = 0; i < nmapqueue; i++)
+        if (mapqueue[i] == ev->window)
+            return;
+    if (nmapqueue == maxmapqueue &&
+        !(mapqueue = realloc(mapqueue, (maxmapqueue = maxmapqueue ? 2 * maxmapqueue : 16) * sizeof(xcb_window_t))))
+        err(EXIT_FAILURE, "cannot queue window");
+    mapqueue[nmapqueue++] = ev->window;
+}
+
+#if MENU
+// the grid cell at x, y in a menu's window, -1 if there is none
+int menucell(Menu *m, int x, int y) {
+    if (x < m->ox || y < m->oy || x >= m->ox + m->cols*100 || y >= m->oy + m->rows*60)
+        return -1;
+    return (y - m->oy)/60 * m->cols + (x - m->ox)/100;
+}
+
+// a click on the open menu, launch the entry under the pointer,
+// the wheel flips pages
+void menuclick(xcb_button_press_event_t *ev) {
+    Menu *m = openmenu;
+    Menu_Entry *found = NULL;
+    int cell;
+
+    DEBUGP("menuclick: x %d y %d\n", ev->event_x, ev->event_y);
+    if (ev->detail == XCB_BUTTON_INDEX_4 || ev->detail == XCB_BUTTON_INDEX_5) {
+        flipmenu(m, m->page + (ev->detail == XCB_BUTTON_INDEX_5 ? 1 : -1));
+        return;
+    }
+    if ((cell = menucell(m, ev->event_x, ev->event_y)) >= 0)
+        found = m->grid[m->page * m->cols * m->rows + cell];
+
+    closemenu();
+    if (found)
+        spawn(&(Arg){.com = (const char**)found->cmd});
+}
+
+// a key pressed while a menu is open. the arrows walk the grid, page
+// up and down flip pages, typing searches $PATH
+void menukey(xcb_keysym_t keysym) {
+    Menu *m = openmenu;
+    Menu_Entry **page = &m->grid[m->page * m->cols * m->rows];
+    int col = m->sel % m->cols, row = m->sel / m->cols, dx = 0, dy = 0;
+
+    if (keysym == XK_Escape) {
+        closemenu();
+        return;
+    }
+    #if MENU_SEARCH
+    if (searchkey(keysym))
+        return;
     #endif
+    switch (keysym) {
+        case XK_Prior: flipmenu(m, m->page - 1); return;
+        case XK_Next:  flipmenu(m, m->page + 1); return;
+        case XK_Left:  dx = -1; break;
+        case XK_Right: dx = 1;  break;
+        case XK_Up:    dy = -1; break;
+        case XK_Down:  dy = 1;  break;
+        case XK_Return:
+            if (m->sel >= 0 && page[m->sel]) {
+                Menu_Entry *found = page[m->sel];
+                closemenu();
+                spawn(&(Arg){.com = (const char**)found->cmd});
+            }
+            return;
+        default: return;
+    }
+
+    if (m->sel < 0) { // nothing selected yet, start in the middle
+        for (Menu_Entry *mentry = m->head; mentry; mentry = mentry->next)
+            if (mentry->page == m->page) {
+                selectmenucell(m, mentry->cell);
+                break;
+            }
+        return;
+    }
+    // skip empty cells, the last page may have holes
+    for (col += dx, row += dy; col >= 0 && col < m->cols && row >= 0 && row < m->rows; col += dx, row += dy)
+        if (page[row * m->cols + col]) {
+            selectmenucell(m, row * m->cols + col);
+            break;
+        }
+}
+
+// cell indexes of a cols x rows grid in the order entries are placed,
+// a square spiral out from the middle that skips what is off the grid
+void menuspiral(int cols, int rows, int *cells) {
+    int x = cols/2, y = rows/2, dx = 1, dy = 0, t, len = 1, step = 0, n = 0;
+
+    while (n < cols * rows) {
+        if (x >= 0 && x < cols && y >= 0 && y < rows)
+            cells[n++] = y * cols + x;
+        x += dx;
+        y += dy;
+        if (++step == len) { // turn left, the legs grow every other turn
+            step = 0;
+            t = dx;
+            dx = dy;
+            dy = -t;
+            if (!dy)
+                len++;
+        }
+    }
 }
+#endif
 
 // each window should cover all the available screen space
 void monocle(const desktop *d, const monitor *m) {
@@ -1605,20 +4379,24 @@ void mousemotion(const Arg *arg) {
     int mx, my, winx, winy, winw, winh, xw, yh;
 
     if (!c) return;
-    geometry = xcb_get_geometry_reply(dis, xcb_get_geometry(dis, c->win), NULL); // TODO: error handling
+    geometry = RECREPLY(xcb_get_geometry_reply(dis, xcb_get_geometry(dis, c->win), NULL)); // TODO: error handling
     if (geometry) {
         winx = geometry->x;     winy = geometry->y;
         winw = geometry->width; winh = geometry->height;
         free(geometry);
     } else return;
 
-    pointer = xcb_query_pointer_reply(dis, xcb_query_pointer(dis, screen->root), 0);
+    pointer = RECREPLY(xcb_query_pointer_reply(dis, xcb_query_pointer(dis, screen->root), 0));
     if (!pointer) return;
     mx = pointer->root_x; my = pointer->root_y;
 
-    grab_reply = xcb_grab_pointer_reply(dis, xcb_grab_pointer(dis, 0, screen->root, BUTTONMASK|XCB_EVENT_MASK_BUTTON_MOTION|XCB_EVENT_MASK_POINTER_MOTION,
-            XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC, XCB_NONE, XCB_NONE, XCB_CURRENT_TIME), NULL);
-    if (!grab_reply || grab_reply->status != XCB_GRAB_STATUS_SUCCESS) return;
+    grab_reply = RECREPLY(xcb_grab_pointer_reply(dis, xcb_grab_pointer(dis, 0, screen->root, BUTTONMASK|XCB_EVENT_MASK_BUTTON_MOTION|XCB_EVENT_MASK_POINTER_MOTION,
+            XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC, XCB_NONE, XCB_NONE, XCB_CURRENT_TIME), NULL));
+    if (!grab_reply || grab_reply->status != XCB_GRAB_STATUS_SUCCESS) {
+        free(grab_reply);
+        return;
+    }
+    free(grab_reply);
 
     xcb_generic_event_t *e = NULL;
     xcb_motion_notify_event_t *ev = NULL;
@@ -1626,9 +4404,9 @@ void mousemotion(const Arg *arg) {
     while (!ungrab && c) {
         if (e) 
             free(e); 
-        xcb_flush(dis);
-        while(!(e = xcb_wait_for_event(dis))) 
-            xcb_flush(dis);
+        FLUSH();
+        if (!(e = waitevent())) // the connection, or the recording, ended
+            break;
         switch (e->response_type & ~0x80) {
             case XCB_CONFIGURE_REQUEST: 
             case XCB_MAP_REQUEST:
@@ -1640,9 +4418,11 @@ void mousemotion(const Arg *arg) {
                 yh = (arg->i == MOVE ? winy : winh) + ev->root_y - my;
                 if (arg->i == RESIZE) { 
                     xcb_resize(c->win, (c->w = xw>MINWSZ?xw:winw), ( c->h = yh>MINWSZ?yh:winh));
+                    geomset(d, c, c->x, c->y, c->w, c->h);
                     setclientborders(d->current, d, selmon);
                 } else if (arg->i == MOVE) {  
                     xcb_move(c->win, (c->x = xw), (c->y = yh));
+                    geomset(d, c, c->x, c->y, c->w, c->h);
             
                     // handle floater moving monitors
                     if (!INRECT(xw, yh, selmon->x, selmon->y, selmon->w, selmon->h)) {
@@ -1666,7 +4446,7 @@ void mousemotion(const Arg *arg) {
                         }
                     }
                 }
-                xcb_flush(dis);
+                FLUSH();
                 break;
             case XCB_KEY_PRESS:
             case XCB_KEY_RELEASE:
@@ -1675,6 +4455,7 @@ void mousemotion(const Arg *arg) {
                 ungrab = true;
         }
     }
+    free(e);
     xcb_ungrab_pointer(dis, XCB_CURRENT_TIME);
 
     if(d->mode == MONOCLE || d->mode == VIDEO)
@@ -1698,13 +4479,13 @@ void moveclient(const Arg *arg) {
             o->xp = c->xp; o->yp = c->yp; o->wp = c->wp; o->hp = c->hp;
             c->xp = list[0]->xp; c->yp = list[0]->yp; c->wp = list[0]->wp; c->hp = list[0]->hp;
             list[0]->xp = o->xp; list[0]->yp = o->yp; list[0]->wp = o->wp; list[0]->hp = o->hp;
+            geomtile(d, c);
+            geomtile(d, list[0]);
            
             SETWINDOW(list[0], d, selmon);
             SETWINDOW(c, d, selmon);
             xcb_move_resize(list[0], d, selmon);
             xcb_move_resize(c, d, selmon);
-            
-            free(list);
         }
     }
 }
@@ -1719,7 +4500,6 @@ void movefocus(const Arg *arg) {
             d->prevfocus = d->current;
             d->current = list[0];
             focus(d->current, d, selmon);
-            free(list);
         }
     } else if (d->mode == MONOCLE || d->mode == VIDEO || d->mode == FLOAT) {
         DEBUG("movefocus: monocle or video\n"); 
@@ -1790,11 +4570,14 @@ void propertynotify(xcb_generic_event_t *e) {
         return;
     }
 
-    #if PRETTY_PRINT
-    if (ev->atom == XCB_ATOM_WM_NAME) {
+    #if STATUS
+    // titles are only fetched for windows whose title is shown, at most
+    // once every TITLE_INTERVAL, see updatetitles()
+    if (ev->atom == XCB_ATOM_WM_NAME || ev->atom == netatoms[NET_WM_NAME]) {
         DEBUG("propertynotify: ev->atom == XCB_ATOM_WM_NAME\n");
-        updatetitle(c);
-        desktopinfo(); 
+        if (c->titlestale || c->titlepending || !titleshown(c))
+            stats.titlessuppressed++;
+        c->titlestale = true;
     }
     #endif
     if (ev->atom != XCB_ICCCM_WM_ALL_HINTS) {
@@ -1803,7 +4586,17 @@ void propertynotify(xcb_generic_event_t *e) {
     }
 }
 
-monitor* ptrtomon(int x, int y) {
+#if METRICS
+void observe(histogram *h, long us) {
+    int i;
+    for (i = 0; i < METRIC_BUCKETS - 1 && us >= 1L << i; i++);
+    h->buckets[i]++;
+    h->count++;
+    h->sum += us;
+}
+#endif
+
+monitor* ptrtomon(int x, int y) {
     monitor *m;
     int i;
 
@@ -1813,6 +4606,106 @@ monitor* ptrtomon(int x, int y) {
     return selmon;
 }
 
+// free every slab of the pool, the objects in them are gone
+void pooldestroy(pool *p) {
+    for (void *slab = p->slabs, *prev; slab; slab = prev) {
+        prev = *(void **)slab;
+        free(slab);
+    }
+    p->free = p->slabs = NULL;
+}
+
+// a zeroed object from the pool, a new slab is allocated if none are free
+void* poolget(pool *p) {
+    void *obj;
+
+    if (!p->free) {
+        char *slab = malloc_safe(p->size * (POOL_SLAB + 1)); // the first is the link
+        *(void **)slab = p->slabs;
+        p->slabs = slab;
+        for (int i = POOL_SLAB; i > 0; i--)
+            poolput(p, slab + i * p->size);
+    }
+    obj = p->free;
+    p->free = *(void **)obj;
+    memset(obj, 0, p->size);
+    return obj;
+}
+
+// give an object from poolget() back
+void poolput(pool *p, void *obj) {
+    *(void **)obj = p->free;
+    p->free = obj;
+}
+
+#if SNAPSHOT
+// copy desktops[] and the monitors into the state file
+//
+// the state is first built in a private copy and only written out if it
+// differs, so readers polling seq see it change once per committed batch
+// that actually changed something
+void publishsnapshot(void) {
+    static snapstate next;
+    monitor *m;
+    client *c;
+    int i, n;
+
+    if (!snap)
+        return;
+
+    memset(&next, 0, sizeof(snapstate));
+    next.seldesktop = selmon ? selmon->curr_dtop : 0;
+    for (i = 0, m = mons; m && i < SNAPSHOT_MONS; m = m->next, i++) {
+        if (m == selmon)
+            next.selmon = i;
+        next.mons[i].id = m->id;
+        next.mons[i].x = m->x; next.mons[i].y = m->y;
+        next.mons[i].w = m->w; next.mons[i].h = m->h;
+        next.mons[i].desktop = m->curr_dtop;
+        next.mons[i].haspanel = m->haspanel;
+    }
+    next.nmons = i;
+
+    for (i = 0, n = 0; i < DESKTOPS; i++) {
+        desktop *d = &desktops[i];
+        next.desktops[i].mode = d->mode;
+        next.desktops[i].direction = d->direction;
+        next.desktops[i].gap = d->gap;
+        next.desktops[i].showpanel = d->showpanel;
+        next.desktops[i].count = d->count;
+        next.desktops[i].current = d->current ? d->current->win : 0;
+        next.desktops[i].prevfocus = d->prevfocus ? d->prevfocus->win : 0;
+        for (c = d->head; c; c = c->next) {
+            next.desktops[i].nclients++;
+            if (n == SNAPSHOT_CLIENTS)
+                continue;
+            next.clients[n].win = c->win;
+            next.clients[n].desktop = i;
+            next.clients[n].x = c->x; next.clients[n].y = c->y;
+            next.clients[n].w = c->w; next.clients[n].h = c->h;
+            next.clients[n].isfloating = c->isfloating;
+            next.clients[n].istransient = c->istransient;
+            n++;
+        }
+    }
+    next.nclients = n;
+    next.stats.titlessuppressed = stats.titlessuppressed;
+    for (i = 0; i < MAPBURST_BUCKETS; i++)
+        next.stats.mapbursts[i] = stats.mapbursts[i];
+    next.stats.mapburstmax = stats.mapburstmax;
+    next.stats.latency = stats.latency;
+
+    if (memcmp(&next, &snap->state, sizeof(snapstate)) == 0)
+        return;
+
+    uint32_t seq = atomic_load_explicit(&snap->seq, memory_order_relaxed);
+    atomic_store_explicit(&snap->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(&snap->state, &next, sizeof(snapstate));
+    atomic_store_explicit(&snap->seq, seq + 2, memory_order_release);
+}
+#endif
+
 void pulltofloat() {
     desktop *d = &desktops[selmon->curr_dtop];
     client *c = d->current;
@@ -1826,6 +4719,7 @@ void pulltofloat() {
         c->y = selmon->h / 4;
         c->w = selmon->w / 2;
         c->h = selmon->h / 2;
+        geomset(d, c, c->x, c->y, c->w, c->h); // no longer a tile for geomhit()
         retile(d, selmon);
     }
 }
@@ -1839,6 +4733,7 @@ void pushtotiling() {
 
     n->isfloating = false;
     n->istransient = false;
+    geomset(d, n, n->x, n->y, n->w, n->h); // tilenew() moves it, it is a tile from now
 
     if (c && c->isfloating)
         c = clientbehindfloater(d);
@@ -1854,6 +4749,423 @@ void quit(const Arg *arg) {
     running = false;
 }
 
+// wait for a child in the main loop, see reapchildren()
+void trackchild(pid_t pid, void (*done)(pid_t pid)) {
+    int fd = -1;
+
+    #ifdef SYS_pidfd_open
+    if (usepidfd && (fd = syscall(SYS_pidfd_open, pid, 0)) >= 0)
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    #endif
+    if (!(procs = realloc(procs, (nprocs + 1) * sizeof(proc))) ||
+        !(pollfds = realloc(pollfds, (POLL_CHILDREN + nprocs + 1) * sizeof(struct pollfd))))
+        err(EXIT_FAILURE, "cannot track child");
+    procs[nprocs] = (proc){ .pid = pid, .done = done };
+    pollfds[POLL_CHILDREN + nprocs++] = (struct pollfd){ .fd = fd, .events = POLLIN };
+}
+
+// call done for every child that exited, with pidfds this reaps them too,
+// a child whose pidfd could not be opened included, sigchld() wakes run()
+// for that one. without pidfds sigchld() reaps them and notes their pids,
+// kill() can't tell a reaped child from a process that got its pid since
+void reapchildren(void) {
+    unsigned int head = atomic_load(&reapedhead);
+    bool lost = head - reapedtail > REAPED_PIDS; // more than the ring holds, fall back to kill()
+
+    for (int i = 0; i < nprocs; i++) {
+        bool exited = false;
+        if (usepidfd)
+            exited = waitpid(procs[i].pid, NULL, WNOHANG) != 0;
+        else if (lost)
+            exited = kill(procs[i].pid, 0) != 0;
+        else
+            for (unsigned int r = reapedtail; r != head && !exited; r++)
+                exited = reapedpids[r & (REAPED_PIDS - 1)] == procs[i].pid;
+        if (!exited)
+            continue;
+        DEBUGP("reapchildren: %d exited\n", procs[i].pid);
+        proc p = procs[i];
+        if (pollfds[POLL_CHILDREN + i].fd >= 0)
+            close(pollfds[POLL_CHILDREN + i].fd);
+        procs[i] = procs[--nprocs];
+        pollfds[POLL_CHILDREN + i] = pollfds[POLL_CHILDREN + nprocs];
+        i--;
+        if (p.done)
+            p.done(p.pid);
+    }
+    reapedtail = head;
+}
+
+// add a record to the -r recording
+void record(int kind, const void *data, uint32_t len) {
+    recordrec r = { .kind = kind, .len = len, .time = ustime() - recordstart };
+    if (fwrite(&r, sizeof(r), 1, recordfile) != 1 || (len && fwrite(data, len, 1, recordfile) != 1))
+        err(EXIT_FAILURE, "cannot record");
+}
+
+// record the name of an atom the first time an event uses it, the ones
+// every server predefines are the same everywhere
+void recordatom(xcb_atom_t atom) {
+    xcb_get_atom_name_reply_t *r;
+    char buf[4 + 256];
+    int len;
+
+    if (atom <= XCB_ATOM_WM_TRANSIENT_FOR)
+        return;
+    for (int i = 0; i < nrecorded; i++)
+        if (recorded[i] == atom)
+            return;
+    if (nrecorded < (int)LENGTH(recorded))
+        recorded[nrecorded++] = atom;
+    if (!(r = XREPLY(xcb_get_atom_name_reply(dis, xcb_get_atom_name(dis, atom), NULL))))
+        return;
+    len = xcb_get_atom_name_name_length(r) < 255 ? xcb_get_atom_name_name_length(r) : 255;
+    memcpy(buf, &atom, 4);
+    memcpy(buf + 4, xcb_get_atom_name_name(r), len);
+    buf[4 + len] = '\0';
+    record(REC_ATOM, buf, 4 + len + 1);
+    free(r);
+}
+
+// record an event with what it takes to replay it, this waits for the
+// server and is only done with -r
+void recordevent(const xcb_generic_event_t *ev) {
+    switch (ev->response_type & ~0x80) {
+        case XCB_PROPERTY_NOTIFY:
+            recordatom(((xcb_property_notify_event_t *)ev)->atom);
+            break;
+        case XCB_CLIENT_MESSAGE: {
+            const xcb_client_message_event_t *cm = (xcb_client_message_event_t *)ev;
+            recordatom(cm->type);
+            if (cm->type == netatoms[NET_WM_STATE]) {
+                recordatom(cm->data.data32[1]);
+                recordatom(cm->data.data32[2]);
+            }
+            break;
+        }
+        case XCB_KEY_PRESS:
+        case XCB_KEY_RELEASE: {
+            xcb_keycode_t code = ((xcb_key_press_event_t *)ev)->detail;
+            record(REC_KEYSYM, (uint32_t[]){ code, xcb_get_keysym(code, 0), xcb_get_keysym(code, 1) }, 12);
+            break;
+        }
+        case XCB_ENTER_NOTIFY: { // the sequence means nothing to another server
+            xcb_generic_event_t e = *ev;
+            e.sequence = ourcrossing(ev);
+            record(REC_EVENT, &e, sizeof(e));
+            return;
+        }
+    }
+    record(REC_EVENT, ev, sizeof(xcb_generic_event_t));
+    if ((ev->response_type & ~0x80) == XCB_MAP_REQUEST) {
+        xcb_window_t win = ((xcb_map_request_event_t *)ev)->window;
+        recordproperty(win, XCB_ATOM_WM_CLASS);
+        recordproperty(win, XCB_ATOM_WM_TRANSIENT_FOR);
+        recordproperty(win, ewmh->_NET_WM_WINDOW_TYPE);
+    }
+}
+
+// record a property of a window for replay() to set on its stand-in
+void recordproperty(xcb_window_t win, xcb_atom_t prop) {
+    xcb_get_property_reply_t *r;
+    xcb_get_atom_name_reply_t *n;
+    char buf[sizeof(recprop) + 1024];
+    recprop *p = (recprop *)buf;
+    int len;
+
+    if (!(r = XREPLY(xcb_get_property_reply(dis, xcb_get_property(dis, 0, win, prop, XCB_GET_PROPERTY_TYPE_ANY, 0, 256), NULL))))
+        return;
+    if (r->type == XCB_NONE) {
+        free(r);
+        return;
+    }
+    memset(p, 0, sizeof(*p));
+    p->window = win;
+    p->format = r->format;
+    if ((n = XREPLY(xcb_get_atom_name_reply(dis, xcb_get_atom_name(dis, prop), NULL)))) {
+        snprintf(p->name, sizeof(p->name), "%.*s", xcb_get_atom_name_name_length(n), xcb_get_atom_name_name(n));
+        free(n);
+    }
+    if ((n = XREPLY(xcb_get_atom_name_reply(dis, xcb_get_atom_name(dis, r->type), NULL)))) {
+        snprintf(p->type, sizeof(p->type), "%.*s", xcb_get_atom_name_name_length(n), xcb_get_atom_name_name(n));
+        free(n);
+    }
+    len = xcb_get_property_value_length(r);
+    if (r->type == XCB_ATOM_ATOM) { // by name, the values are this server's
+        xcb_atom_t *atoms = xcb_get_property_value(r);
+        char *q = buf + sizeof(*p);
+        for (int i = 0; i < len / 4; i++)
+            if ((n = XREPLY(xcb_get_atom_name_reply(dis, xcb_get_atom_name(dis, atoms[i]), NULL)))) {
+                int l = xcb_get_atom_name_name_length(n);
+                if (q + l + 1 <= buf + sizeof(buf)) {
+                    memcpy(q, xcb_get_atom_name_name(n), l);
+                    q[l] = '\0';
+                    q += l + 1;
+                }
+                free(n);
+            }
+        len = q - (buf + sizeof(*p));
+    } else {
+        len = len < 1024 ? len : 1024;
+        memcpy(buf + sizeof(*p), xcb_get_property_value(r), len);
+    }
+    record(REC_PROPERTY, buf, sizeof(*p) + len);
+    free(r);
+}
+
+// with -r, record a reply a handler got. with -p, drop the one the stand-in
+// sent and hand out the recorded one instead
+void* recordreply(void *reply) {
+    xcb_generic_reply_t *r = reply;
+
+    if (recordfile && recordstart)
+        record(REC_REPLY, r, r && 32 + r->length * 4 <= RECORD_MAX ? 32 + r->length * 4 : 0);
+    else if (replaying.f) {
+        if (nextrecord() != REC_REPLY) {
+            warnx("%s: replies out of step with the handlers", replaying.file);
+            holdrecord();
+            return reply;
+        }
+        free(reply);
+        if (!replaying.r.len)
+            return NULL;
+        reply = malloc_safe(replaying.r.len);
+        memcpy(reply, replaying.buf, replaying.r.len);
+    }
+    return reply;
+}
+
+// the record nextrecord() returned last comes again on the next call
+void holdrecord(void) {
+    replaying.held = true;
+}
+
+/* the next event, commit or reply of the recording, in replaying.r and
+ * replaying.buf, or -1 at the end. atoms and properties on the way are
+ * put in place, ids and atoms in events are translated and windows that
+ * asked to be mapped get a stand-in
+ */
+int nextrecord(void) {
+    replayer *p = &replaying;
+    char *buf = p->buf;
+    xcb_generic_event_t *ev = (xcb_generic_event_t *)buf;
+
+    if (p->held) {
+        p->held = false;
+        return p->r.kind;
+    }
+    while (fread(&p->r, sizeof(p->r), 1, p->f) == 1) {
+        if (p->r.len > RECORD_MAX || (p->r.len && fread(buf, p->r.len, 1, p->f) != 1))
+            errx(EXIT_FAILURE, "%s is truncated", p->file);
+        buf[p->r.len] = '\0';
+
+        if (p->r.kind == REC_ATOM) {
+            uint32_t from;
+            memcpy(&from, buf, 4);
+            if (from > XCB_ATOM_WM_TRANSIENT_FOR) // predefined ones are the same everywhere
+                lookupid(&p->atoms, &p->satoms, &p->natoms, from, fakeatom(buf + 4));
+        } else if (p->r.kind == REC_PROPERTY) {
+            recprop *rp = (recprop *)buf;
+            char *value = buf + sizeof(*rp);
+            int len = p->r.len - sizeof(*rp), n = len / (rp->format / 8 ? rp->format / 8 : 1);
+            xcb_atom_t prop = fakeatom(rp->name), type = fakeatom(rp->type), list[256];
+            if (type == XCB_ATOM_ATOM) {
+                n = 0;
+                for (char *q = value; q < value + len && n < (int)LENGTH(list); q += strlen(q) + 1)
+                    list[n++] = fakeatom(q);
+                value = (char *)list;
+            } else if (type == XCB_ATOM_WINDOW && len >= 4) {
+                uint32_t *w = (uint32_t *)value;
+                *w = lookupid(&p->ids, &p->sids, &p->nids, *w, 0);
+            }
+            xb->property(XCB_PROP_MODE_REPLACE, lookupid(&p->ids, &p->sids, &p->nids, rp->window, 0),
+                         prop, type, rp->format, n, value);
+        } else if (p->r.kind == REC_KEYSYM) {
+            uint32_t k[3];
+            memcpy(k, buf, sizeof(k));
+            p->keysyms[k[0] & 0xff][0] = k[1];
+            p->keysyms[k[0] & 0xff][1] = k[2];
+        } else if (p->r.kind == REC_EVENT) {
+            #define ID(x)   (x) = lookupid(&p->ids, &p->sids, &p->nids, (x), 0)
+            #define ATOM(x) (x) = lookupid(&p->atoms, &p->satoms, &p->natoms, (x), (x) <= XCB_ATOM_WM_TRANSIENT_FOR ? (x) : 0)
+            if (p->randr >= 0 && randrbase >= 0 && ev->response_type == p->randr + XCB_RANDR_SCREEN_CHANGE_NOTIFY)
+                ev->response_type = randrbase + XCB_RANDR_SCREEN_CHANGE_NOTIFY;
+            switch (ev->response_type & ~0x80) {
+                case XCB_KEY_PRESS: case XCB_KEY_RELEASE: case XCB_BUTTON_PRESS: case XCB_BUTTON_RELEASE:
+                case XCB_MOTION_NOTIFY: case XCB_ENTER_NOTIFY: case XCB_LEAVE_NOTIFY: {
+                    xcb_enter_notify_event_t *e = (xcb_enter_notify_event_t *)ev;
+                    ID(e->root); ID(e->event); ID(e->child);
+                    break;
+                }
+                case XCB_FOCUS_IN: case XCB_FOCUS_OUT:
+                    ID(((xcb_focus_in_event_t *)ev)->event);
+                    break;
+                case XCB_EXPOSE:
+                    ID(((xcb_expose_event_t *)ev)->window);
+                    break;
+                case XCB_DESTROY_NOTIFY: case XCB_UNMAP_NOTIFY: case XCB_MAP_NOTIFY: {
+                    xcb_unmap_notify_event_t *e = (xcb_unmap_notify_event_t *)ev;
+                    ID(e->event); ID(e->window);
+                    break;
+                }
+                case XCB_MAP_REQUEST: { // the window stands in for the recorded one
+                    xcb_map_request_event_t *e = (xcb_map_request_event_t *)ev;
+                    uint32_t win = lookupid(&p->ids, &p->sids, &p->nids, e->window, 0);
+                    if (!win) {
+                        win = xb->id();
+                        lookupid(&p->ids, &p->sids, &p->nids, e->window, win);
+                    }
+                    e->window = win;
+                    ID(e->parent);
+                    break;
+                }
+                case XCB_CONFIGURE_REQUEST: {
+                    xcb_configure_request_event_t *e = (xcb_configure_request_event_t *)ev;
+                    ID(e->parent); ID(e->window); ID(e->sibling);
+                    break;
+                }
+                case XCB_CONFIGURE_NOTIFY: {
+                    xcb_configure_notify_event_t *e = (xcb_configure_notify_event_t *)ev;
+                    ID(e->event); ID(e->window); ID(e->above_sibling);
+                    break;
+                }
+                case XCB_PROPERTY_NOTIFY:
+                    ID(((xcb_property_notify_event_t *)ev)->window);
+                    ATOM(((xcb_property_notify_event_t *)ev)->atom);
+                    break;
+                case XCB_CLIENT_MESSAGE: {
+                    xcb_client_message_event_t *e = (xcb_client_message_event_t *)ev;
+                    ID(e->window);
+                    ATOM(e->type);
+                    if (e->type == netatoms[NET_WM_STATE]) {
+                        ATOM(e->data.data32[1]);
+                        ATOM(e->data.data32[2]);
+                    }
+                    break;
+                }
+            }
+            #undef ID
+            #undef ATOM
+            return REC_EVENT;
+        } else
+            return p->r.kind;
+    }
+    return -1;
+}
+
+// 4wm -p, feed a recording through the event handlers as fast as they go,
+// no X server is needed. the fake backend stands in for the recorded
+// server, a screen of its size with one monitor, a window for every window
+// that asked to be mapped with the properties manage() reads, and atoms
+// made from the recorded names. the ids and atoms in the events are
+// translated. dis is a connection in error, so requests that are not
+// replayed are dropped and their replies are missing, the pointer, geometry
+// and RandR answers come from the recording, see RECREPLY. prints how long
+// it took and a digest of the final layout to compare runs by
+int replay(const char *file) {
+    unsigned long nevents = 0, ncommits = 0;
+    xcb_generic_event_t event;
+    recordhdr h;
+    int64_t start;
+    int kind;
+
+    if (!(replaying.f = fopen(file, "re")))
+        err(EXIT_FAILURE, "cannot open %s", file);
+    replaying.file = file;
+    if (fread(&h, sizeof(h), 1, replaying.f) != 1 || h.magic != RECORD_MAGIC || h.version != RECORD_VERSION)
+        errx(EXIT_FAILURE, "%s is not a 4wm recording", file);
+    dis = xcb_connect_to_fd(-1, NULL);
+    fakesetup(h.width, h.height);
+    setupevents();
+    for (int i = 0; i < WM_COUNT; i++)
+        wmatoms[i] = fakeatom(wmatomnames[i]);
+    for (int i = 0; i < NET_COUNT; i++)
+        netatoms[i] = fakeatom(netatomnames[i]);
+    if (!(ewmh = calloc(1, sizeof(xcb_ewmh_connection_t))))
+        err(EXIT_FAILURE, "cannot allocate replay atoms");
+    ewmh->connection = dis;
+    ewmh->_NET_WM_NAME = netatoms[NET_WM_NAME];
+    ewmh->_NET_WM_WINDOW_TYPE = fakeatom("_NET_WM_WINDOW_TYPE");
+    ewmh->_NET_WM_WINDOW_TYPE_SPLASH = fakeatom("_NET_WM_WINDOW_TYPE_SPLASH");
+    ewmh->_NET_WM_WINDOW_TYPE_DIALOG = fakeatom("_NET_WM_WINDOW_TYPE_DIALOG");
+    ewmh->_NET_WM_WINDOW_TYPE_DROPDOWN_MENU = fakeatom("_NET_WM_WINDOW_TYPE_DROPDOWN_MENU");
+    ewmh->_NET_WM_WINDOW_TYPE_POPUP_MENU = fakeatom("_NET_WM_WINDOW_TYPE_POPUP_MENU");
+    ewmh->_NET_WM_WINDOW_TYPE_TOOLTIP = fakeatom("_NET_WM_WINDOW_TYPE_TOOLTIP");
+    ewmh->_NET_WM_WINDOW_TYPE_NOTIFICATION = fakeatom("_NET_WM_WINDOW_TYPE_NOTIFICATION");
+    randrbase = replaying.randr = h.randr;
+    lookupid(&replaying.ids, &replaying.sids, &replaying.nids, h.root, screen->root);
+
+    start = ustime();
+    while ((kind = nextrecord()) >= 0) {
+        if (kind == REC_EVENT) {
+            // a handler may read on and reuse the buffer
+            memcpy(&event, replaying.buf, sizeof(event));
+            runevent(&event);
+            nevents++;
+        } else if (kind == REC_COMMIT) {
+            commit();
+            FLUSH();
+            ncommits++;
+        }
+    }
+    fclose(replaying.f);
+    replaying.f = NULL;
+    long took = ustime() - start;
+
+    uint64_t digest = 14695981039346656037ULL;
+    for (int i = 0; i < DESKTOPS; i++) {
+        digest = fnv(digest, &desktops[i].mode, sizeof(int));
+        for (client *c = desktops[i].head; c; c = c->next) {
+            int g[] = { c->x, c->y, c->w, c->h, c->xp, c->yp, c->wp, c->hp, c->isfloating };
+            digest = fnv(digest, g, sizeof(g));
+        }
+    }
+    printf("4wm: replayed %lu events in %lu commits in %ldus, %.0f events/s, layout %016llx\n",
+           nevents, ncommits, took, took ? nevents * 1e6 / took : 0.0, (unsigned long long)digest);
+    #if METRICS
+    writemetrics();
+    #endif
+    free(replaying.ids);
+    free(replaying.atoms);
+    free(fake.wins);
+    free(fake.ids);
+    free(fake.atoms);
+    free(ewmh);
+    xcb_disconnect(dis);
+    return EXIT_SUCCESS;
+}
+
+// look up from in an open addressed table of ids, adding it as to if it is
+// missing and to isn't 0. returns what from maps to, or 0
+uint32_t lookupid(idpair **map, int *size, int *n, uint32_t from, uint32_t to) {
+    int i;
+
+    if (!from)
+        return 0;
+    if (2 * (*n + 1) > *size) { // grow, keeping it at most half full
+        idpair *old = *map;
+        int oldsize = *size;
+        *size = *size ? 2 * *size : 1024;
+        if (!(*map = calloc(*size, sizeof(idpair))))
+            err(EXIT_FAILURE, "cannot allocate replay ids");
+        for (i = 0; i < oldsize; i++)
+            if (old[i].from) {
+                int j = (old[i].from * 2654435761u) & (*size - 1);
+                while ((*map)[j].from) j = (j + 1) & (*size - 1);
+                (*map)[j] = old[i];
+            }
+        free(old);
+    }
+    for (i = (from * 2654435761u) & (*size - 1); (*map)[i].from; i = (i + 1) & (*size - 1))
+        if ((*map)[i].from == from)
+            return (*map)[i].to;
+    if (!to)
+        return 0;
+    (*map)[i] = (idpair){ .from = from, .to = to };
+    (*n)++;
+    return to;
+}
+
 // remove the specified client
 //
 // note, the removing client can be on any desktop,
@@ -1874,10 +5186,16 @@ void removeclient(client *c, desktop *d, const monitor *m, bool delete) {
     if(d->current && m)
         focus(d->current, d, m);
     else
-        xcb_set_input_focus(dis, XCB_INPUT_FOCUS_POINTER_ROOT, screen->root, XCB_CURRENT_TIME);
+        xb->focus(XCB_INPUT_FOCUS_POINTER_ROOT, screen->root, XCB_CURRENT_TIME);
 
-    free(c->title);
-    free(c); c = NULL; 
+    #if STATUS
+    if (c->titlepending) {
+        xcb_discard_reply(dis, c->titlereq[0]);
+        xcb_discard_reply(dis, c->titlereq[1]);
+    }
+    releasetitle(c->title);
+    #endif
+    poolput(&clientpool, c); c = NULL;
     #if PRETTY_PRINT
     updatews();
     desktopinfo();
@@ -1891,6 +5209,7 @@ void removeclientfromlist(client *c, desktop *d) {
         return;
     else 
         *p = c->next;
+    geomremove(d, c);
     if (c == d->prevfocus) 
         d->prevfocus = prev_client(d->current, d);
     if (c == d->current) {
@@ -1899,6 +5218,83 @@ void removeclientfromlist(client *c, desktop *d) {
     }
 }
 
+#if MENU
+// create the menu's window and draw every page into its pixmap, once
+void rendermenu(Menu *m) {
+    uint32_t values[3] = { screen->black_pixel, 1, XCB_EVENT_MASK_EXPOSURE|XCB_EVENT_MASK_BUTTON_PRESS|XCB_EVENT_MASK_KEY_PRESS };
+
+    m->w = selmon->w;
+    m->h = selmon->h;
+    m->win = xb->id();
+    xcb_create_window(dis, XCB_COPY_FROM_PARENT, m->win, screen->root, selmon->x, selmon->y, m->w, m->h, 0,
+                      XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual,
+                      XCB_CW_BACK_PIXEL|XCB_CW_OVERRIDE_REDIRECT|XCB_CW_EVENT_MASK, values);
+    m->pmaps = NULL;
+    menupixmaps(m);
+}
+
+// a pixmap of the menu's size for each page, with the page drawn in it
+void menupixmaps(Menu *m) {
+    m->pmaps = (xcb_pixmap_t*)realloc(m->pmaps, m->npages * sizeof(xcb_pixmap_t));
+    if (!m->pmaps)
+        err(EXIT_FAILURE, "cannot allocate menu pages");
+    for (int p = 0; p < m->npages; p++) {
+        m->pmaps[p] = xb->id();
+        xb->pixmap(screen->root_depth, m->pmaps[p], screen->root, m->w, m->h);
+    }
+    drawmenu(m);
+}
+
+// lay a menu out again for selmon if it was drawn for another size, after
+// a RandR change or to open on a monitor of another size
+void fitmenu(Menu *m) {
+    if (m->w == selmon->w && m->h == selmon->h)
+        return;
+    DEBUGP("fitmenu: %dx%d to %dx%d\n", m->w, m->h, selmon->w, selmon->h);
+    for (int p = 0; p < m->npages; p++)
+        xb->freepixmap(m->pmaps[p]);
+    m->w = selmon->w;
+    m->h = selmon->h;
+    layoutmenu(m);
+    xb->configure(m->win, XCB_RESIZE, (uint32_t[]){ m->w, m->h });
+    menupixmaps(m);
+}
+
+// draw every page of a menu into its pixmap
+void drawmenu(Menu *m) {
+    char label[32];
+    int i = 0;
+
+    for (int p = 0; p < m->npages; p++) {
+        xb->fill(m->pmaps[p], xres.gc_clear, 1, &(xcb_rectangle_t){ 0, 0, m->w, m->h });
+        if (m->npages > 1) {
+            snprintf(label, sizeof(label), "%d/%d", p + 1, m->npages);
+            text_draw(xres.gc_text, m->pmaps[p], 8, m->h - 8, label);
+        }
+    }
+    for (Menu_Entry *mentry = m->head; mentry; mentry = mentry->next) {
+        xb->fill(m->pmaps[mentry->page], xres.gc_color[i], 1, &mentry->rectangle);
+        text_draw(xres.font_gc[i], m->pmaps[mentry->page], mentry->x + 10, mentry->y + 30, mentry->cmd[0]);
+        if (i == 11) i = 0;
+        else i++;
+    }
+}
+
+#endif
+
+// write the trace ring to tracepath, only async signal safe calls as this
+// also runs from sigcrash()
+void dumptrace(void) {
+    tracehdr h = { .magic = TRACE_MAGIC, .size = TRACE_SIZE, .head = tracehead };
+    int fd;
+
+    if (!*tracepath || (fd = open(tracepath, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644)) < 0)
+        return;
+    if (write(fd, &h, sizeof(h)) != sizeof(h) || write(fd, tracering, sizeof(tracering)) != sizeof(tracering))
+        unlink(tracepath);
+    close(fd);
+}
+
 void resizeclient(const Arg *arg) {
     desktop *d = &desktops[selmon->curr_dtop];
     client *c;
@@ -1911,8 +5307,7 @@ void resizeclient(const Arg *arg) {
         }
         monitor *m = wintomon(c->win);
 
-        client** p = (client**)malloc_safe(2 * sizeof(client*));
-        p[0] = c;
+        client *p[2] = { c, NULL };
         resize[arg->i](arg->p, p, d, m);
     }
 } 
@@ -1923,8 +5318,6 @@ void resizeclientbottom(const int size, client **c, desktop *d, monitor *m) {
         adjustbyh(c, list, size, d, m);
     else if ((list = clientstothe[TTOP](c[0], d, true)))
         adjustbyh(list, c, size, d, m);
-
-    free(list);
 }
 
 void resizeclientleft(const int size, client **c, desktop *d, monitor *m) {
@@ -1933,8 +5326,6 @@ void resizeclientleft(const int size, client **c, desktop *d, monitor *m) {
         adjustbyw(list, c, -size, d, m);
     else if ((list = clientstothe[TRIGHT](c[0], d, true)))
         adjustbyw(c, list, -size, d, m);
-
-    free(list);
 }
 
 void resizeclientright(const int size, client **c, desktop *d, monitor *m) {
@@ -1943,8 +5334,6 @@ void resizeclientright(const int size, client **c, desktop *d, monitor *m) {
         adjustbyw(c, list, size, d, m);
     else if ((list = clientstothe[TLEFT](c[0], d, true)))
         adjustbyw(list, c, size, d, m);
-
-    free(list);
 }
 
 void resizeclienttop(const int size, client **c, desktop *d, monitor *m) {
@@ -1953,13 +5342,163 @@ void resizeclienttop(const int size, client **c, desktop *d, monitor *m) {
         adjustbyh(list, c, -size, d, m);
     else if ((list = clientstothe[TBOTTOM](c[0], d, true)))
         adjustbyh(c, list, -size, d, m);
+}
 
-    free(list);
+// hand the layout to a fresh 4wm, main() execs it once run() returned
+void restart(const Arg *arg) {
+    (void)arg;
+    restarting = true;
+    running = false;
+}
+
+// take the layout from the 4wm before us as is, the windows are already
+// where it left them, so nothing is queried or retiled
+bool restorestate(int fd) {
+    struct stat st;
+    statehdr *h;
+
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(statehdr)
+        || (h = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    close(fd);
+
+    deskstate *ds = (deskstate *)(h + 1);
+    monstate *ms = (monstate *)(ds + h->ndesktops);
+    clientstate *cs = (clientstate *)(ms + h->nmons);
+    uint32_t *pids = (uint32_t *)(cs + h->nclients);
+    if (h->magic != STATE_MAGIC || h->version != STATE_VERSION || h->ndesktops != DESKTOPS
+        || (char *)(pids + h->nprocs) > (char *)h + st.st_size) {
+        warnx("ignoring the state of the previous 4wm");
+        munmap(h, st.st_size);
+        return false;
+    }
+
+    // monitors are matched by output, a desktop shown elsewhere is swapped
+    for (uint32_t i = 0; i < h->nmons; i++) {
+        monitor *m, *o;
+        if (ms[i].curr_dtop < 0 || ms[i].curr_dtop >= DESKTOPS)
+            continue;
+        for (m = mons; m && m->id != ms[i].id; m = m->next);
+        if (!m)
+            continue;
+        for (o = mons; o && o->curr_dtop != ms[i].curr_dtop; o = o->next);
+        if (o)
+            o->curr_dtop = m->curr_dtop;
+        m->curr_dtop = ms[i].curr_dtop;
+        if ((int32_t)i == h->selmon)
+            selmon = m;
+    }
+
+    // windows may have gone while 4wm restarted, ask for all at once
+    xcb_window_t wins[h->nclients + 1];
+    xcb_get_window_attributes_reply_t *attr[h->nclients + 1];
+    client *gone[h->nclients + 1];
+    int gonedesk[h->nclients + 1], ngone = 0;
+    for (uint32_t i = 0; i < h->nclients; i++)
+        wins[i] = cs[i].win;
+    xcb_get_attributes(wins, attr, h->nclients);
+
+    for (uint32_t i = 0; i < h->nclients; i++) {
+        client *c;
+        if (cs[i].desktop < 0 || cs[i].desktop >= DESKTOPS) {
+            free(attr[i]);
+            continue;
+        }
+        if (attr[i])
+            c = addwindow(cs[i].win, &desktops[cs[i].desktop]);
+        else { // keeps its tile until the neighbours take it over below
+            c = poolget(&clientpool);
+            c->win = cs[i].win;
+            addclienttolist(c, &desktops[cs[i].desktop]);
+            gonedesk[ngone] = cs[i].desktop;
+            gone[ngone++] = c;
+        }
+        c->x  = cs[i].x;  c->y  = cs[i].y;  c->w  = cs[i].w;  c->h  = cs[i].h;
+        c->xp = cs[i].xp; c->yp = cs[i].yp; c->wp = cs[i].wp; c->hp = cs[i].hp;
+        c->pid = cs[i].pid;
+        c->istransient = cs[i].istransient;
+        c->isfloating  = cs[i].isfloating;
+        geomset(&desktops[cs[i].desktop], c, c->x, c->y, c->w, c->h);
+        geomtile(&desktops[cs[i].desktop], c);
+        if (attr[i])
+            grabbuttons(c);
+        #if STATUS
+        c->titlestale = true;
+        #endif
+        free(attr[i]);
+    }
+
+    for (int i = 0; i < DESKTOPS; i++) {
+        desktop *d = &desktops[i];
+        client *c;
+        int n;
+        d->mode      = ds[i].mode;
+        d->gap       = ds[i].gap;
+        d->direction = ds[i].direction;
+        d->showpanel = ds[i].showpanel;
+        d->count     = ds[i].count;
+        for (c = d->head, n = 0; c && n != ds[i].current; c = c->next, n++);
+        d->current = c ? c : d->head;
+        for (c = d->head, n = 0; c && n != ds[i].prevfocus; c = c->next, n++);
+        d->prevfocus = c;
+    }
+
+    for (int i = 0; i < ngone; i++) {
+        monitor *m;
+        for (m = mons; m && m->curr_dtop != gonedesk[i]; m = m->next);
+        DEBUGP("restorestate: %u is gone\n", gone[i]->win);
+        removeclient(gone[i], &desktops[gonedesk[i]], m, false);
+    }
+
+    // children launched before, still to be reaped
+    for (uint32_t i = 0; i < h->nprocs; i++)
+        trackchild(pids[i], NULL);
+
+    if (desktops[selmon->curr_dtop].current)
+        focus(desktops[selmon->curr_dtop].current, &desktops[selmon->curr_dtop], selmon);
+    DEBUGP("restorestate: %u clients on %u monitors\n", h->nclients, h->nmons);
+    munmap(h, st.st_size);
+    return true;
+}
+
+// where a command is on $PATH, or NULL. lookups are cached and a cached
+// path is only checked with access() before it is used again
+const char* resolvecmd(const char *name) {
+    char *path = getenv("PATH"), file[PATH_MAX];
+    cmdpath *cp;
+
+    if (strchr(name, '/'))
+        return name;
+    for (cp = cmdpaths; cp; cp = cp->next)
+        if (strcmp(cp->name, name) == 0) {
+            if (access(cp->path, X_OK) == 0)
+                return cp->path;
+            break; // gone, look again
+        }
+
+    for (const char *p = path ? path : ""; *p; p += strcspn(p, ":"), p += *p == ':') {
+        int n = strcspn(p, ":");
+        if (!n || snprintf(file, sizeof(file), "%.*s/%s", n, p, name) >= (int)sizeof(file) || access(file, X_OK) < 0)
+            continue;
+        if (!cp) {
+            cp = (cmdpath*)malloc_safe(sizeof(cmdpath));
+            cp->name = strdup(name);
+            cp->next = cmdpaths;
+            cmdpaths = cp;
+        } else
+            free(cp->path);
+        cp->path = strdup(file);
+        return cp->path;
+    }
+    return NULL;
 }
 
 void retile(desktop *d, const monitor *m) {
+    int64_t start = tracing ? ustime() : 0;
+    COUNT(retiles);
     if (d->mode == TILE || d->mode == FLOAT) {
-        DEBUGP("retile: d->count = %d\n", d->count);
        
         for (client *c = d->head; c; c=c->next) {
 
@@ -1971,53 +5510,430 @@ void retile(desktop *d, const monitor *m) {
                 for ( ; c->x >= m->x + m->w; c->x -= m->w);
                 for ( ; c->y >= m->y + m->h; c->y -= m->h);
 
-                for ( ; c->x < m->x; c->x += m->w);
-                for ( ; c->y < m->y; c->y += m->h);
-                
-                xcb_raise_window(c->win);
-                xcb_move_resize(c, d, m);
-            }
-        } 
+                for ( ; c->x < m->x; c->x += m->w);
+                for ( ; c->y < m->y; c->y += m->h);
+                
+                xcb_raise_window(c->win);
+                xcb_move_resize(c, d, m);
+            }
+        } 
+    }
+    else
+        monocle(d, m);
+    TRACE(TP_RETILE, 0, 0, start, d->count);
+}
+
+// jump and focus the next or previous desktop
+void rotate(const Arg *arg) {
+    change_desktop(&(Arg){.i = (DESKTOPS + selmon->curr_dtop + arg->i) % DESKTOPS});
+}
+
+// jump and focus the next or previous desktop that has clients
+void rotate_filled(const Arg *arg) {
+    int n = arg->i;
+    while (n < DESKTOPS && !desktops[(DESKTOPS + selmon->curr_dtop + n) % DESKTOPS].head) (n += arg->i);
+    change_desktop(&(Arg){.i = (DESKTOPS + selmon->curr_dtop + n) % DESKTOPS});
+}
+
+/* the next event, from the ring of reader() when it runs, else from xcb.
+ * queued only returns what xcb already read, like xcb_poll_for_queued_event()
+ */
+xcb_generic_event_t* nextevent(bool queued) {
+    #if READER
+    if (readerfd >= 0) {
+        unsigned int tail = atomic_load_explicit(&ringtail, memory_order_relaxed);
+        if (tail == atomic_load(&ringhead))
+            return NULL;
+        queuedevent *q = &ring[tail & (READER_RING - 1)];
+        xcb_generic_event_t *ev = q->ev;
+        #if METRICS
+        observe(&stats.queued, ustime() - q->time);
+        #endif
+        atomic_store(&ringtail, tail + 1);
+        return ev;
+    }
+    #endif
+    return queued ? xcb_poll_for_queued_event(dis) : xcb_poll_for_event(dis);
+}
+
+/* blocks for the next event, NULL once the connection is gone. handlers
+ * that take events themselves go through here, so -r records them and -p
+ * plays them back like the ones run() takes
+ */
+xcb_generic_event_t* waitevent(void) {
+    xcb_generic_event_t *ev;
+    int kind;
+
+    if (replaying.f) {
+        while ((kind = nextrecord()) == REC_REPLY); // not asked for, out of step
+        if (kind != REC_EVENT) {    // the recorded handler stopped here
+            holdrecord();
+            return NULL;
+        }
+        ev = malloc_safe(sizeof(xcb_generic_event_t));
+        return memcpy(ev, replaying.buf, sizeof(xcb_generic_event_t));
+    }
+    #if READER
+    eventfd_t n;
+    if (readerfd >= 0) {
+        while (!(ev = nextevent(false)) && !xcb_connection_has_error(dis)) {
+            poll(&(struct pollfd){ .fd = readerfd, .events = POLLIN }, 1, -1);
+            eventfd_read(readerfd, &n);
+        }
+    } else
+    #endif
+    ev = xcb_wait_for_event(dis);
+    if (ev && recordfile && recordstart)
+        recordevent(ev);
+    return ev;
+}
+
+#if READER
+/* runs in a thread of its own and only reads events off the X socket, so
+ * the server never blocks on a full socket while a handler waits for a
+ * reply or commit() runs, and every event is stamped when it arrived. xcb
+ * locks the connection itself, the main thread sends requests and reads
+ * replies as before but takes events only through nextevent()
+ *
+ * the ring has one writer and one reader: head is only moved here, tail
+ * only by nextevent(). the main thread is woken through readerfd when it
+ * may have emptied the ring, both sides store their index before loading
+ * the other one so a wakeup can't get lost between them
+ */
+void* reader(void *arg) {
+    xcb_generic_event_t *ev;
+    unsigned int head;
+
+    (void)arg;
+    while ((ev = xcb_wait_for_event(dis))) {
+        head = atomic_load_explicit(&ringhead, memory_order_relaxed);
+        while (head - atomic_load(&ringtail) == READER_RING) {
+            COUNT(readerstalls);
+            nanosleep(&(struct timespec){ .tv_nsec = 100000 }, NULL);
+        }
+        ring[head & (READER_RING - 1)] = (queuedevent){ ev, ustime() };
+        atomic_store(&ringhead, head + 1);
+        if (atomic_load(&ringtail) == head)
+            eventfd_write(readerfd, 1);
+    }
+    eventfd_write(readerfd, 1); // the connection is gone, let run() see it
+    return NULL;
+}
+
+void startreader(void) {
+    sigset_t all, old;
+
+    if ((readerfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0) {
+        warn("cannot start the event reader");
+        return;
+    }
+    // signals stay with the main thread, they are meant to interrupt poll()
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    if ((errno = pthread_create(&readerthread, NULL, reader, NULL))) {
+        warn("cannot start the event reader");
+        close(readerfd);
+        readerfd = -1;
+    } else
+        pollfds[POLL_X].fd = readerfd;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+// flushes what is left to send and stops reader() by closing the read side
+void stopreader(void) {
+    if (readerfd < 0)
+        return;
+    FLUSH();
+    shutdown(xcb_get_file_descriptor(dis), SHUT_RD);
+    pthread_join(readerthread, NULL);
+    for (xcb_generic_event_t *ev; (ev = nextevent(false)); free(ev));
+    close(readerfd);
+    readerfd = -1;
+}
+#endif
+
+// act on the signals sigwake() passed on. SIGHUP reloads the colors,
+// SIGUSR1 writes the metrics and SIGUSR2 the trace ring, SIGCHLD only
+// wakes poll() for reapchildren()
+void runsignals(void) {
+    unsigned char sigs[64];
+    ssize_t len;
+
+    while ((len = read(pollfds[POLL_SIGNAL].fd, sigs, sizeof(sigs))) > 0)
+        for (ssize_t i = 0; i < len; i++)
+            switch (sigs[i]) {
+                case SIGHUP:  reloadpending = true; break;
+                #if METRICS
+                case SIGUSR1: writemetrics(); break;
+                #endif
+                case SIGUSR2: dumptrace(); break;
+            }
+}
+
+// main event loop - on receival of an event call the appropriate event handler
+//
+// events are handled in batches, every event that can be read without
+// blocking is handled, then the resulting state is committed. only then
+// the loop sleeps until the connection is readable or a timer is due
+void run(void) {
+    xcb_generic_event_t *ev, *next = NULL; 
+    bool idle;
+
+    while(running) {
+        DEBUG("run: running\n");
+        FLUSH();
+        if (xcb_connection_has_error(dis)) {
+            DEBUG("run: x11 connection got interrupted\n");
+            err(EXIT_FAILURE, "error: X11 connection got interrupted\n");
+        }
+        for (idle = true; running && (ev = next ? next : nextevent(false)); idle = false) {
+            next = NULL;
+            if (recordfile)
+                recordevent(ev);
+            runevent(ev);
+            free(ev);
+        }
+        #if METRICS
+        int64_t start = ustime();
+        commit();
+        observe(&stats.handlers[HANDLER_COMMIT], ustime() - start);
+        #else
+        int64_t start = tracing ? ustime() : 0;
+        commit();
+        #endif
+        TRACE(TP_COMMIT, 0, 0, start, 0);
+        if (recordfile)
+            record(REC_COMMIT, NULL, 0);
+
+        // committing may have read more events along with replies
+        if (!running || !idle || (next = nextevent(true)))
+            continue;
+        FLUSH();
+        #if STATUS && READER
+        // reader() takes title replies off the socket and poll() never sees
+        // them. wait for them here instead of waking up to look, they answer
+        // requests already sent, so that is one round trip at most
+        if (readerfd >= 0 && titlespending()) {
+            if (updatetitles(true)) {
+                #if PRETTY_PRINT
+                desktopinfo();
+                #endif
+            }
+            continue;
+        }
+        #endif
+        #if STATUS
+        poll(pollfds, POLL_CHILDREN + nprocs, titletimeout());
+        #else
+        poll(pollfds, POLL_CHILDREN + nprocs, -1);
+        #endif
+        #if READER
+        eventfd_t n;
+        if (pollfds[POLL_X].revents && readerfd >= 0)
+            eventfd_read(readerfd, &n);
+        #endif
+        if (pollfds[POLL_SIGNAL].revents)
+            runsignals();
+        if (nprocs) // a pidfd went readable, or sigchld() woke poll
+            reapchildren();
+        if (reloadpending || pollfds[POLL_RELOAD].revents)
+            checkreload();
+    }
+    free(next);
+}
+
+// call the appropriate event handler for a single event
+void runevent(xcb_generic_event_t *ev) {
+    #if METRICS
+    int64_t start = ustime();
+    #else
+    int64_t start = tracing ? ustime() : 0;
+    #endif
+    if (ev->response_type==randrbase + XCB_RANDR_SCREEN_CHANGE_NOTIFY) {
+        DEBUG("run: entering getrandr()\n");
+        getrandr();
+    }
+    // a window still queued by maprequest() is managed before an event about
+    // it, e.g. a fullscreen request right after the map, finds no client
+    xcb_window_t w = nmapqueue && (ev->response_type & ~0x80) != XCB_MAP_REQUEST ? eventwindow(ev) : 0;
+    for (int i = 0; w && i < nmapqueue; i++)
+        if (mapqueue[i] == w) {
+            manage(mapqueue, NULL, nmapqueue);
+            nmapqueue = 0;
+        }
+    #if AUDIT
+    curhandler = ev->response_type & ~0x80;
+    #endif
+    if (events[ev->response_type & ~0x80]) {
+        DEBUGP("run: entering event %d\n", ev->response_type & ~0x80);
+        events[ev->response_type & ~0x80](ev);
+    }
+    else {DEBUGP("xcb: unimplented event: %d\n", ev->response_type & ~0x80);}
+    #if AUDIT
+    curhandler = HANDLER_NONE;
+    #endif
+    #if METRICS
+    observe(&stats.handlers[ev->response_type & ~0x80], ustime() - start);
+    #endif
+    TRACE(TP_EVENT, eventwindow(ev), ev->response_type & ~0x80, start, ev->sequence);
+    scratchreset();
+}
+
+#if LAYOUTS
+// save the tiles of the current desktop and the class of the window in
+// each under the name arg->com[0], see applylayout()
+void savelayout(const Arg *arg) {
+    desktop *d = &desktops[selmon->curr_dtop];
+    char path[PATH_MAX], tmp[PATH_MAX + 4];
+    client *c;
+    int nc = 0, i;
+    FILE *f;
+
+    if (!layoutpath(arg->com[0], path, sizeof(path)))
+        return;
+    for (c = d->head; c; c = c->next)
+        if (!ISFT(c)) nc++;
+    client *tiles[nc + 1];
+    char classes[nc + 1][64];
+    for (c = d->head, i = 0; c; c = c->next)
+        if (!ISFT(c)) tiles[i++] = c;
+    getclasses(tiles, nc, classes);
+
+    // make the directories, then write and rename so it's never half there
+    for (char *p = strchr(path + 1, '/'); p; p = strchr(p + 1, '/')) {
+        *p = '\0';
+        mkdir(path, 0755);
+        *p = '/';
+    }
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if (!(f = fopen(tmp, "w"))) {
+        warn("cannot save layout %s", arg->com[0]);
+        return;
+    }
+    for (i = 0; i < nc; i++)
+        fprintf(f, "%d %d %d %d %s\n", tiles[i]->xp, tiles[i]->yp, tiles[i]->wp, tiles[i]->hp,
+                *classes[i] ? classes[i] : "-");
+    if (fclose(f) == EOF || rename(tmp, path) < 0)
+        warn("cannot save layout %s", arg->com[0]);
+    npending[selmon->curr_dtop] = 0;
+}
+#endif
+
+// write the layout for restart() into a memfd, returns it or -1
+int savestate(void) {
+    #ifdef SYS_memfd_create
+    statehdr h = { .magic = STATE_MAGIC, .version = STATE_VERSION, .ndesktops = DESKTOPS, .selmon = -1 };
+    size_t size;
+    char *buf, *p;
+    int fd;
+
+    for (monitor *m = mons; m; m = m->next)
+        h.nmons++;
+    for (int i = 0; i < DESKTOPS; i++)
+        for (client *c = desktops[i].head; c; c = c->next)
+            h.nclients++;
+    h.nprocs = nprocs;
+    size = sizeof(h) + DESKTOPS * sizeof(deskstate) + h.nmons * sizeof(monstate)
+         + h.nclients * sizeof(clientstate) + h.nprocs * sizeof(uint32_t);
+    if ((fd = syscall(SYS_memfd_create, "4wm-state", 0)) < 0) {
+        warn("cannot create the restart state");
+        return -1;
+    }
+
+    p = buf = malloc_safe(size);
+    memcpy(p, &h, sizeof(h));
+    p += sizeof(h);
+    for (int i = 0; i < DESKTOPS; i++) {
+        const desktop *d = &desktops[i];
+        deskstate ds = { .mode = d->mode, .gap = d->gap, .direction = d->direction, .count = d->count,
+                         .current = -1, .prevfocus = -1, .showpanel = d->showpanel };
+        int n = 0;
+        for (client *c = d->head; c; c = c->next, n++) {
+            if (c == d->current)   ds.current = n;
+            if (c == d->prevfocus) ds.prevfocus = n;
+        }
+        memcpy(p, &ds, sizeof(ds));
+        p += sizeof(ds);
+    }
+    int n = 0;
+    for (monitor *m = mons; m; m = m->next, n++) {
+        monstate ms = { .id = m->id, .curr_dtop = m->curr_dtop };
+        if (m == selmon)
+            ((statehdr *)buf)->selmon = n;
+        memcpy(p, &ms, sizeof(ms));
+        p += sizeof(ms);
+    }
+    for (int i = 0; i < DESKTOPS; i++)
+        for (client *c = desktops[i].head; c; c = c->next) {
+            clientstate cs = { .win = c->win, .desktop = i, .pid = c->pid,
+                               .x = c->x, .y = c->y, .w = c->w, .h = c->h,
+                               .xp = c->xp, .yp = c->yp, .wp = c->wp, .hp = c->hp,
+                               .istransient = c->istransient, .isfloating = c->isfloating };
+            memcpy(p, &cs, sizeof(cs));
+            p += sizeof(cs);
+        }
+    for (int i = 0; i < nprocs; i++) {
+        uint32_t pid = procs[i].pid;
+        memcpy(p, &pid, sizeof(pid));
+        p += sizeof(pid);
+    }
+
+    if (write(fd, buf, size) != (ssize_t)size) {
+        warn("cannot write the restart state");
+        close(fd);
+        fd = -1;
     }
-    else
-        monocle(d, m);
+    free(buf);
+    return fd;
+    #else
+    return -1;
+    #endif
 }
 
-// jump and focus the next or previous desktop
-void rotate(const Arg *arg) {
-    change_desktop(&(Arg){.i = (DESKTOPS + selmon->curr_dtop + arg->i) % DESKTOPS});
+#if MENU
+// outline cell in the open menu, putting back the old selection first
+void selectmenucell(Menu *m, int cell) {
+    Menu_Entry **page = &m->grid[m->page * m->cols * m->rows];
+
+    if (m->sel >= 0 && m->sel != cell) {
+        Menu_Entry *old = page[m->sel];
+        xb->copy(m->pmaps[m->page], m->win, xres.gc_copy, old->x, old->y, old->x, old->y, 100, 60);
+    }
+    if ((m->sel = cell) >= 0)
+        xcb_poly_rectangle(dis, m->win, xres.gc_text, 1, &(xcb_rectangle_t){ page[cell]->x + 2, page[cell]->y + 2, 95, 55 });
 }
+#endif
 
-// jump and focus the next or previous desktop that has clients
-void rotate_filled(const Arg *arg) {
-    int n = arg->i;
-    while (n < DESKTOPS && !desktops[(DESKTOPS + selmon->curr_dtop + n) % DESKTOPS].head) (n += arg->i);
-    change_desktop(&(Arg){.i = (DESKTOPS + selmon->curr_dtop + n) % DESKTOPS});
+// memory for the event being handled, gone after scratchreset()
+void* scratchalloc(size_t size) {
+    void *p;
+
+    size = (size + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1);
+    if (!scratch.base)
+        scratch.base = malloc_safe((scratch.size = SCRATCH_SIZE));
+    if (scratch.used + size <= scratch.size) {
+        p = scratch.base + scratch.used;
+        scratch.used += size;
+        return p;
+    }
+    if (scratch.nspill == scratch.maxspill) {
+        scratch.maxspill = scratch.maxspill ? 2 * scratch.maxspill : 8;
+        if (!(scratch.spill = realloc(scratch.spill, scratch.maxspill * sizeof(void *))))
+            err(EXIT_FAILURE, "cannot allocate scratch");
+    }
+    scratch.spilled += size;
+    return scratch.spill[scratch.nspill++] = malloc_safe(size);
 }
 
-// main event loop - on receival of an event call the appropriate event handler
-void run(void) {
-    xcb_generic_event_t *ev; 
-    while(running) {
-        DEBUG("run: running\n");
-        xcb_flush(dis);
-        if (xcb_connection_has_error(dis)) {
-            DEBUG("run: x11 connection got interrupted\n");
-            err(EXIT_FAILURE, "error: X11 connection got interrupted\n");
-        }
-        if ((ev = xcb_wait_for_event(dis))) {
-            if (ev->response_type==randrbase + XCB_RANDR_SCREEN_CHANGE_NOTIFY) {
-                DEBUG("run: entering getrandr()\n");
-                getrandr();
-            }
-            if (events[ev->response_type & ~0x80]) {
-                DEBUGP("run: entering event %d\n", ev->response_type & ~0x80);
-                events[ev->response_type & ~0x80](ev);
-            }
-            else {DEBUGP("xcb: unimplented event: %d\n", ev->response_type & ~0x80);}
-            free(ev);
-        }
+// drop everything scratchalloc() handed out
+void scratchreset(void) {
+    for (int i = 0; i < scratch.nspill; i++)
+        free(scratch.spill[i]);
+    if (scratch.spilled) {
+        free(scratch.base);
+        scratch.base = malloc_safe((scratch.size += scratch.spilled));
     }
+    scratch.nspill = scratch.spilled = scratch.used = 0;
 }
 
 void setclientborders(client *c, const desktop *d, const monitor *m) {
@@ -2030,14 +5946,14 @@ void setclientborders(client *c, const desktop *d, const monitor *m) {
 
     // find n = number of windows with set borders
     int n = d->count;
-    DEBUGP("setclientborders: d->count = %d\n", d->count);
+    int64_t start = tracing ? ustime() : 0;
 
     // rules for no border
     if ((!c->isfloating && n == 1) || (d->mode == MONOCLE) || (d->mode == VIDEO)) {
-        xcb_configure_window(dis, c->win, XCB_CONFIG_WINDOW_BORDER_WIDTH, zero);
+        xb->configure(c->win, XCB_CONFIG_WINDOW_BORDER_WIDTH, zero);
     }
     else {
-        xcb_configure_window(dis, c->win, XCB_CONFIG_WINDOW_BORDER_WIDTH, values);
+        xb->configure(c->win, XCB_CONFIG_WINDOW_BORDER_WIDTH, values);
         half = OUTER_BORDER;
         const xcb_rectangle_t rect_inner[] = {
             { c->w,0, BORDER_WIDTH-half,c->h+BORDER_WIDTH-half},
@@ -2052,40 +5968,42 @@ void setclientborders(client *c, const desktop *d, const monitor *m) {
             {0,c->h+BORDER_WIDTH-half,c->w+BORDER_WIDTH*2,half},
             {0,c->h+BORDER_WIDTH,c->w+BORDER_WIDTH*2,half}
         };
-        xcb_pixmap_t pmap = xcb_generate_id(dis);
+        xcb_pixmap_t pmap = xb->id();
         // 2bwm test have shown that drawing the pixmap directly on the root 
         // window is faster then drawing it on the window directly
-        xcb_create_pixmap(dis, screen->root_depth, pmap, c->win, c->w+(BORDER_WIDTH*2), c->h+(BORDER_WIDTH*2));
-        xcb_gcontext_t gc = xcb_generate_id(dis);
-        xcb_create_gc(dis, gc, pmap, 0, NULL);
+        xb->pixmap(screen->root_depth, pmap, c->win, c->w+(BORDER_WIDTH*2), c->h+(BORDER_WIDTH*2));
+        xcb_gcontext_t gc = xb->id();
+        xb->gc(gc, pmap, 0, NULL);
         
-        xcb_change_gc(dis, gc, XCB_GC_FOREGROUND, (c->isfloating ? &win_flt:&win_outer));
-        xcb_poly_fill_rectangle(dis, pmap, gc, 4, rect_outer);
+        xb->changegc(gc, XCB_GC_FOREGROUND, (c->isfloating ? &win_flt:&win_outer));
+        xb->fill(pmap, gc, 4, rect_outer);
 
-        xcb_change_gc(dis, gc, XCB_GC_FOREGROUND, (c == d->current && m == selmon ? &win_focus:&win_unfocus));
-        xcb_poly_fill_rectangle(dis, pmap, gc, 5, rect_inner);
-        xcb_change_window_attributes(dis,c->win, XCB_CW_BORDER_PIXMAP, &pmap);
+        xb->changegc(gc, XCB_GC_FOREGROUND, (c == d->current && m == selmon ? &win_focus:&win_unfocus));
+        xb->fill(pmap, gc, 5, rect_inner);
+        xb->attributes(c->win, XCB_CW_BORDER_PIXMAP, &pmap);
         // free the memory we allocated for the pixmap
-        xcb_free_pixmap(dis,pmap);
-        xcb_free_gc(dis,gc);
+        xb->freepixmap(pmap);
+        xb->freegc(gc);
     }
-    xcb_flush(dis);
-    DEBUG("setclientborders: leaving\n");
+    FLUSH();
+    TRACE(TP_BORDERS, c->win, 0, start, n);
 }
 
 // get numlock modifier using xcb
-int setup_keyboard(void) {
+int setup_keyboard(xcb_get_modifier_mapping_cookie_t cookie) {
     xcb_get_modifier_mapping_reply_t *reply;
     xcb_keycode_t                    *modmap;
     xcb_keycode_t                    *numlock;
 
-    reply   = xcb_get_modifier_mapping_reply(dis, xcb_get_modifier_mapping_unchecked(dis), NULL); /* TODO: error checking */
+    reply   = XREPLY(xcb_get_modifier_mapping_reply(dis, cookie, NULL)); /* TODO: error checking */
     if (!reply) return -1;
 
     modmap = xcb_get_modifier_mapping_keycodes(reply);
-    if (!modmap) return -1;
+    if (!modmap || !(numlock = xcb_get_keycodes(XK_Num_Lock))) {
+        free(reply);
+        return -1;
+    }
 
-    numlock = xcb_get_keycodes(XK_Num_Lock);
     for (unsigned int i=0; i<8; i++)
        for (unsigned int j=0; j<reply->keycodes_per_modifier; j++) {
            xcb_keycode_t keycode = modmap[i * reply->keycodes_per_modifier + j];
@@ -2097,6 +6015,8 @@ int setup_keyboard(void) {
                    break;
                }
        }
+    free(numlock);
+    free(reply);
 
     return 0;
 }
@@ -2105,22 +6025,135 @@ int setup_keyboard(void) {
 // root window - screen height/width - atoms - xerror handler
 // set masks for reporting events handled by the wm
 // and propagate the suported net atoms
+// the handler of each event, for setup() and replay()
+void setupevents(void) {
+    for (unsigned int i=0; i<XCB_NO_OPERATION; i++) events[i] = NULL;
+    events[XCB_BUTTON_PRESS]                = buttonpress;
+    events[XCB_CLIENT_MESSAGE]              = clientmessage;
+    events[XCB_CONFIGURE_REQUEST]           = configurerequest;
+    //events[XCB_CONFIGURE_NOTIFY]            = configurenotify;
+    events[XCB_DESTROY_NOTIFY]              = destroynotify;
+    events[XCB_ENTER_NOTIFY]                = enternotify;
+    events[XCB_EXPOSE]                      = expose;
+    events[XCB_FOCUS_IN]                    = focusin;
+    events[XCB_KEY_PRESS]                   = keypress;
+    events[XCB_MAPPING_NOTIFY]              = mappingnotify;
+    events[XCB_MAP_REQUEST]                 = maprequest;
+    events[XCB_PROPERTY_NOTIFY]             = propertynotify;
+    events[XCB_UNMAP_NOTIFY]                = unmapnotify;
+    events[XCB_NONE]                        = NULL;
+}
+
 int setup(int default_screen) {
+    // with pidfds children are reaped in the main loop, see reapchildren()
+    #ifdef SYS_pidfd_open
+    int fd = syscall(SYS_pidfd_open, getpid(), 0);
+    if ((usepidfd = fd >= 0))
+        close(fd);
+    #endif
     sigchld();
+    timephase(NULL);
+    pollfds = (struct pollfd*)malloc_safe(POLL_CHILDREN * sizeof(struct pollfd));
+    pollfds[POLL_X] = (struct pollfd){ .fd = xcb_get_file_descriptor(dis), .events = POLLIN };
+    pollfds[POLL_RELOAD] = (struct pollfd){ .fd = -1, .events = POLLIN };
+    fcntl(pollfds[POLL_X].fd, F_SETFD, FD_CLOEXEC);
+    int sigpipe[2];
+    if (pipe(sigpipe) < 0)
+        err(EXIT_FAILURE, "cannot create the signal pipe");
+    for (int i = 0; i < 2; i++) {
+        fcntl(sigpipe[i], F_SETFD, FD_CLOEXEC);
+        fcntl(sigpipe[i], F_SETFL, O_NONBLOCK);
+    }
+    pollfds[POLL_SIGNAL] = (struct pollfd){ .fd = sigpipe[0], .events = POLLIN };
+    sigwritefd = sigpipe[1];
     screen = xcb_screen_of_display(dis, default_screen);
     if (!screen) err(EXIT_FAILURE, "error: cannot aquire screen\n");
-    
+
+    // send everything that doesn't depend on an answer up front, the
+    // replies are collected below, so startup waits on the server once
+    // instead of once per request
+    xcb_intern_atom_cookie_t wmcookies[WM_COUNT], netcookies[NET_COUNT], *ewmhcookies;
+    xcb_void_cookie_t otherwm = xcb_selectroot();
+    xcb_get_modifier_mapping_cookie_t modcookie = xcb_get_modifier_mapping_unchecked(dis);
+    xcb_intern_atoms(wmatomnames, wmcookies, WM_COUNT);
+    xcb_intern_atoms(netatomnames, netcookies, NET_COUNT);
+    ewmh = malloc_safe(sizeof(xcb_ewmh_connection_t));
+    ewmhcookies = xcb_ewmh_init_atoms(dis, ewmh);
+    xcb_prefetch_extension_data(dis, &xcb_randr_id);
+    if (!(keysyms = xcb_key_symbols_alloc(dis)))
+        err(EXIT_FAILURE, "error: failed to setup keyboard\n");
+    timephase("requests");
+
+    /* check if another wm is running */
+    if (xcb_checkotherwm(otherwm))
+        err(EXIT_FAILURE, "error: other wm is running\n");
+
+    /* set up atoms for dialog/notification windows */
+    xcb_get_atoms(wmatomnames, wmcookies, wmatoms, WM_COUNT);
+    xcb_get_atoms(netatomnames, netcookies, netatoms, NET_COUNT);
+
+    /* initialize EWMH */
+    if (!xcb_ewmh_init_atoms_replies(ewmh, ewmhcookies, (void *)0))
+        err(EXIT_FAILURE, "error: failed to set ewmh atoms\n");
+
+    /* setup keyboard */
+    if (setup_keyboard(modcookie) == -1)
+        err(EXIT_FAILURE, "error: failed to setup keyboard\n");
+    timephase("atoms");
+
     randrbase = setuprandr();
-    //DEBUG("exited setuprandr, continuing setup\n");
+    timephase("randr");
 
     selmon = mons; 
     for (unsigned int i=0; i<DESKTOPS; i++)
         desktops[i] = (desktop){ .mode = DEFAULT_MODE, .direction = DEFAULT_DIRECTION, .showpanel = SHOW_PANEL, .gap = GAP, .count = 0, };
 
-    win_focus   = getcolor(FOCUS);
-    win_unfocus = getcolor(UNFOCUS);
-    win_outer   = getcolor(OTRBRDRCOL);
-    win_flt     = getcolor(FLTBRDCOL);
+    // colors are computed locally on TrueColor visuals, see getcolor()
+    for (xcb_depth_iterator_t di = xcb_screen_allowed_depths_iterator(screen); di.rem && !visual; xcb_depth_next(&di))
+        for (xcb_visualtype_iterator_t vi = xcb_depth_visuals_iterator(di.data); vi.rem; xcb_visualtype_next(&vi))
+            if (vi.data->visual_id == screen->root_visual) {
+                visual = vi.data;
+                break;
+            }
+
+    // colors can be reloaded with SIGHUP or by saving ~/.Xdefaults
+    char *home = getenv("HOME");
+    struct passwd *pw = home ? NULL : getpwuid(getuid());
+    unsigned int border[BORDER_COLORS], menucolors[12];
+    snprintf(xdefaults, sizeof(xdefaults), "%s/.Xdefaults", home ? home : pw ? pw->pw_dir : "");
+    XrmInitialize();
+    loadcolors(border, menucolors);
+    win_focus   = border[COL_FOCUS];
+    win_unfocus = border[COL_UNFOCUS];
+    win_outer   = border[COL_OUTER];
+    win_flt     = border[COL_FLOAT];
+    #if MENU
+    memcpy(xres.color, menucolors, sizeof(menucolors));
+    #endif
+    if ((pollfds[POLL_RELOAD].fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC)) >= 0) {
+        char dir[PATH_MAX];
+        snprintf(dir, sizeof(dir), "%s", xdefaults);
+        inotify_add_watch(pollfds[POLL_RELOAD].fd, dirname(dir), IN_CLOSE_WRITE|IN_MOVED_TO);
+    }
+    if (signal(SIGHUP, sigwake) == SIG_ERR)
+        err(EXIT_FAILURE, "cannot install SIGHUP handler");
+    #if METRICS
+    if (signal(SIGUSR1, sigwake) == SIG_ERR)
+        err(EXIT_FAILURE, "cannot install SIGUSR1 handler");
+    #endif
+
+    // SIGUSR2 and crashes write the trace, see dumptrace()
+    char *rundir = getenv("XDG_RUNTIME_DIR"), *display = getenv("DISPLAY");
+    if (rundir) {
+        snprintf(tracepath, sizeof(tracepath), "%s/4wm-%s.trace", rundir, display ? display : "");
+        for (char *p = tracepath + strlen(rundir) + 1; *p; p++)
+            if (*p == '/') *p = '_';
+    }
+    signal(SIGUSR2, sigwake);
+    int crashes[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+    for (unsigned int i = 0; i < LENGTH(crashes); i++)
+        signal(crashes[i], sigcrash);
+    timephase("colors");
 
     #if MENU
     // initialize the menu 
@@ -2138,53 +6171,28 @@ int setup(int default_screen) {
     }
 
     initializexresources();
+    for (m = menus; m; m = m->next)
+        rendermenu(m);
+    timephase("menus");
+    #endif
+    #if MENU_SEARCH
+    setuppathindex();
+    timephase("pathindex");
     #endif
 
-    /* setup keyboard */
-    if (setup_keyboard() == -1)
-        err(EXIT_FAILURE, "error: failed to setup keyboard\n");
-
-    /* set up atoms for dialog/notification windows */
-    char *WM_ATOM_NAME[]   = { "WM_PROTOCOLS", "WM_DELETE_WINDOW" };
-    char *NET_ATOM_NAME[]  = { "_NET_SUPPORTED", "_NET_WM_STATE_FULLSCREEN", "_NET_WM_STATE", "_NET_WM_NAME", "_NET_ACTIVE_WINDOW" };
-    xcb_get_atoms(WM_ATOM_NAME, wmatoms, WM_COUNT);
-    xcb_get_atoms(NET_ATOM_NAME, netatoms, NET_COUNT);
-
-    /* check if another wm is running */
-    if (xcb_checkotherwm())
-        err(EXIT_FAILURE, "error: other wm is running\n");
-
-    /* initialize EWMH */
-    ewmh = malloc_safe(sizeof(xcb_ewmh_connection_t));
-    if (!ewmh)
-        err(EXIT_FAILURE, "error: failed to set ewmh atoms\n");
-    xcb_ewmh_init_atoms_replies(ewmh, xcb_ewmh_init_atoms(dis, ewmh), (void *)0);
-
-    xcb_change_property(dis, XCB_PROP_MODE_REPLACE, screen->root, netatoms[NET_SUPPORTED], XCB_ATOM_ATOM, 32, NET_COUNT, netatoms);
+    xb->property(XCB_PROP_MODE_REPLACE, screen->root, netatoms[NET_SUPPORTED], XCB_ATOM_ATOM, 32, NET_COUNT, netatoms);
     grabkeys();
+    timephase("keys");
 
-    /* set events */
-    for (unsigned int i=0; i<XCB_NO_OPERATION; i++) events[i] = NULL;
-    events[XCB_BUTTON_PRESS]                = buttonpress;
-    events[XCB_CLIENT_MESSAGE]              = clientmessage;
-    events[XCB_CONFIGURE_REQUEST]           = configurerequest;
-    //events[XCB_CONFIGURE_NOTIFY]            = configurenotify;
-    events[XCB_DESTROY_NOTIFY]              = destroynotify;
-    events[XCB_ENTER_NOTIFY]                = enternotify;
-    #if PRETTY_PRINT
-    events[XCB_EXPOSE]                      = expose;
-    #endif
-    events[XCB_FOCUS_IN]                    = focusin;
-    events[XCB_KEY_PRESS|XCB_KEY_RELEASE]   = keypress;
-    events[XCB_MAPPING_NOTIFY]              = mappingnotify;
-    events[XCB_MAP_REQUEST]                 = maprequest;
-    events[XCB_PROPERTY_NOTIFY]             = propertynotify;
-    events[XCB_UNMAP_NOTIFY]                = unmapnotify;
-    events[XCB_NONE]                        = NULL;
+    setupevents();
 
     //DEBUG("setup: about to switch to default desktop\n");
-    if (DEFAULT_DESKTOP >= 0 && DEFAULT_DESKTOP < DESKTOPS)
+    // after a restart the layout is taken as it was, else whatever is
+    // already on the screen is taken over
+    if ((statefd < 0 || !restorestate(statefd)) && DEFAULT_DESKTOP >= 0 && DEFAULT_DESKTOP < DESKTOPS)
         change_desktop(&(Arg){.i = DEFAULT_DESKTOP});
+    adopt();
+    timephase("adopt");
     
     // new pipe to messenger, panel, dzen
     #if PRETTY_PRINT
@@ -2225,9 +6233,63 @@ int setup(int default_screen) {
     }
     #endif
 
+    #if BAR
+    setupbar();
+    updatebars();
+    #endif
+
+    #if SNAPSHOT
+    setupsnapshot();
+    #endif
+    timephase("finish");
+    timephase("total");
+
     return 0;
 }
 
+#if BAR
+// open the bar font and render the glyph atlas
+//
+// BAR_FONT should be fixed width, every glyph gets a cell as wide as the
+// widest glyph of the font
+void setupbar(void) {
+    char *colors[] = { BAR_COL_CURRENT, BAR_COL_VISIBLE, BAR_COL_HIDDEN, BAR_COL_MODE, BAR_COL_DIR, BAR_COL_TITLE };
+    char glyphs[BAR_GLYPHS];
+    xcb_font_t font = xb->id();
+    xcb_gcontext_t gc = xb->id();
+    xcb_query_font_reply_t *info;
+    uint32_t values[3];
+
+    xcb_open_font(dis, font, strlen(BAR_FONT), BAR_FONT);
+    if (!(info = XREPLY(xcb_query_font_reply(dis, xcb_query_font(dis, font), NULL))))
+        errx(EXIT_FAILURE, "error: cannot open bar font '%s'\n", BAR_FONT);
+    atlas.cw = info->max_bounds.character_width;
+    atlas.ch = info->font_ascent + info->font_descent;
+    atlas.ascent = info->font_ascent;
+    free(info);
+
+    atlas.bg = getcolor(BAR_COL_BG);
+    atlas.pmap = xb->id();
+    xb->pixmap(screen->root_depth, atlas.pmap, screen->root, atlas.cw * BAR_GLYPHS, atlas.ch * BAR_COLORS);
+
+    for (int i = 0; i < BAR_GLYPHS; i++)
+        glyphs[i] = ' ' + i;
+    values[0] = atlas.bg; values[1] = atlas.bg; values[2] = font;
+    xb->gc(gc, atlas.pmap, XCB_GC_FOREGROUND|XCB_GC_BACKGROUND|XCB_GC_FONT, values);
+    for (int i = 0; i < BAR_COLORS; i++) {
+        values[0] = getcolor(colors[i]);
+        xb->changegc(gc, XCB_GC_FOREGROUND, values);
+        xb->text(BAR_GLYPHS, atlas.pmap, gc, 0, i * atlas.ch + atlas.ascent, glyphs);
+    }
+    xb->freegc(gc);
+    xcb_close_font(dis, font);
+
+    atlas.gc = xb->id();
+    values[0] = atlas.bg; values[1] = 0;
+    xb->gc(atlas.gc, screen->root, XCB_GC_FOREGROUND|XCB_GC_GRAPHICS_EXPOSURES, values);
+}
+#endif
+
 int setuprandr(void) { // Set up RANDR extension. Get the extension base and subscribe to
     // events.
     const xcb_query_extension_reply_t *extension = xcb_get_extension_data(dis, &xcb_randr_id);
@@ -2240,21 +6302,184 @@ int setuprandr(void) { // Set up RANDR extension. Get the extension base and sub
     return base;
 }
 
+#if SNAPSHOT
+// create the state file under $XDG_RUNTIME_DIR and map it, the file is
+// named after the display so several instances don't collide
+void setupsnapshot(void) {
+    char *dir = getenv("XDG_RUNTIME_DIR"), *display = getenv("DISPLAY");
+    int fd;
+
+    if (!dir) {
+        fputs("WARN: 4wm: XDG_RUNTIME_DIR is not set, not publishing state\n", stderr);
+        return;
+    }
+    snprintf(snappath, sizeof(snappath), "%s/4wm-%s.state", dir, display ? display : "");
+    for (char *p = snappath + strlen(dir) + 1; *p; p++)
+        if (*p == '/') *p = '_';
+
+    if ((fd = open(snappath, O_RDWR|O_CREAT|O_CLOEXEC, 0644)) < 0) {
+        warn("cannot open %s", snappath);
+        return;
+    }
+    if (ftruncate(fd, sizeof(snapshot)) < 0 ||
+        (snap = mmap(NULL, sizeof(snapshot), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        warn("cannot map %s", snappath);
+        snap = NULL;
+        close(fd);
+        return;
+    }
+    close(fd);
+
+    // readers must not trust the file until magic is set
+    snap->magic = 0;
+    atomic_store(&snap->seq, 0);
+    memset(&snap->state, 0, sizeof(snapstate));
+    snap->version = SNAPSHOT_VERSION;
+    snap->ndesktops = DESKTOPS;
+    publishsnapshot();
+    atomic_thread_fence(memory_order_release);
+    snap->magic = SNAPSHOT_MAGIC;
+}
+#endif
+
+// without pidfds reap every child that exited and note its pid for
+// reapchildren(). with them reapchildren() does the reaping, this only wakes
+// it for a child whose pidfd could not be opened
 void sigchld() {
+    pid_t pid;
+
     if (signal(SIGCHLD, sigchld) == SIG_ERR)
         err(EXIT_FAILURE, "cannot install SIGCHLD handler");
-    while(0 < waitpid(-1, NULL, WNOHANG));
+    while (!usepidfd && 0 < (pid = waitpid(-1, NULL, WNOHANG)))
+        reapedpids[atomic_fetch_add_explicit(&reapedhead, 1, memory_order_relaxed) & (REAPED_PIDS - 1)] = pid;
+    sigwake(SIGCHLD);
+}
+
+// dump the trace on the way down, then die of the signal as usual
+void sigcrash(int sig) {
+    dumptrace();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+// pass the signal to run() through the POLL_SIGNAL pipe. a signal that
+// comes after run() last looked still wakes poll(), see runsignals()
+void sigwake(int sig) {
+    unsigned char c = sig;
+    int saved = errno;
+
+    while (write(sigwritefd, &c, 1) < 0 && errno == EINTR);
+    errno = saved;
+}
+
+// 4wm -S, open and close SOAK_WINDOWS windows n times on the server 4wm
+// is connected to, which should be a scratch one like Xvfb. each round the
+// windows get titles, the desktops, modes and tile sizes are cycled and the
+// windows are destroyed, all through the usual handlers. memory is sampled
+// once a tenth of the rounds warmed up and again at the end, growing more
+// than SOAK_RSS or SOAK_HEAP fails
+int soak(int n) {
+    xcb_window_t wins[SOAK_WINDOWS];
+    long rss0 = 0, rss;
+    size_t heap0 = 0, heap;
+    int home = selmon->curr_dtop, modes[] = { MONOCLE, VIDEO, FLOAT, TILE };
+    char title[32];
+
+    for (int i = 0; i < n; i++) {
+        if (i == n / 10)
+            memusage(&rss0, &heap0);
+        for (int j = 0; j < SOAK_WINDOWS; j++) {
+            xcb_map_request_event_t ev = { .response_type = XCB_MAP_REQUEST, .parent = screen->root };
+            xcb_create_window(dis, XCB_COPY_FROM_PARENT, (wins[j] = xb->id()), screen->root, 0, 0, 1, 1, 0,
+                              XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual, 0, NULL);
+            ev.window = wins[j];
+            runevent((xcb_generic_event_t *)&ev); // 4wm's own maps are not redirected
+        }
+        soaksync();
+        for (int j = 0; j < SOAK_WINDOWS; j++) {
+            int len = snprintf(title, sizeof(title), "soak %d/%d", i, j);
+            xcb_change_property(dis, XCB_PROP_MODE_REPLACE, wins[j], ewmh->_NET_WM_NAME, ewmh->UTF8_STRING, 8, len, title);
+        }
+        soaksync();
+        for (int k = 1; k <= DESKTOPS; k++)
+            change_desktop(&(Arg){.i = (home + k) % DESKTOPS});
+        for (unsigned int k = 0; k < LENGTH(modes); k++)
+            switch_mode(&(Arg){.i = modes[k]});
+        for (int k = 0; k < TDIRECS; k++) {
+            resizeclient(&(Arg){.i = k, .p = 10});
+            resizeclient(&(Arg){.i = k, .p = -10});
+        }
+        for (int j = 0; j < SOAK_WINDOWS; j++)
+            xcb_destroy_window(dis, wins[j]);
+        soaksync();
+        if (n >= 10 && i % (n / 10) == 0) {
+            memusage(&rss, &heap);
+            printf("4wm: round %d, rss %ld, heap %zu\n", i, rss, heap);
+        }
+    }
+    memusage(&rss, &heap);
+    printf("4wm: %d windows, rss %+ld, heap %+ld since round %d\n", n * SOAK_WINDOWS,
+           rss - rss0, (long)heap - (long)heap0, n / 10);
+    if (rss - rss0 > SOAK_RSS || (long)heap - (long)heap0 > SOAK_HEAP) {
+        warnx("memory grew past the bound");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+// wait for the server to catch up, then handle what it sent as run() would
+void soaksync(void) {
+    xcb_generic_event_t *ev;
+
+    free(XREPLY(xcb_get_input_focus_reply(dis, xcb_get_input_focus(dis), NULL)));
+    while ((ev = xcb_poll_for_event(dis))) {
+        runevent(ev);
+        free(ev);
+    }
+    commit();
+    FLUSH();
 }
 
 // execute a command
 void spawn(const Arg *arg) {
-    if (fork()) return;
-    if (dis) close(screen->root);
-    setsid();
-    execvp((char*)arg->com[0], (char**)arg->com);
-    fprintf(stderr, "error: execvp %s", (char *)arg->com[0]);
-    perror(" failed"); // also prints the err msg
-    exit(EXIT_SUCCESS);
+    #if RESERVE_SLOTS
+    spawnon(&(Arg){.com = arg->com, .i = selmon->curr_dtop});
+    #else
+    launch(arg->com, NULL, NULL);
+    #endif
+}
+
+// execute a command, its window goes to desktop arg->i and splits the tile
+// that is current there now. the place is held in a slot until the window
+// maps, then it goes straight there without touching the shown desktop
+void spawnon(const Arg *arg) {
+    #if RESERVE_SLOTS
+    static unsigned int launches = 0;
+    desktop *d = &desktops[arg->i];
+    slot *s = NULL;
+    int64_t now = mstime();
+    char id[sizeof(s->id)];
+    pid_t pid;
+
+    if (arg->i < 0 || arg->i >= DESKTOPS)
+        return;
+    snprintf(id, sizeof(id), "4wm%d-%u_TIME0", getpid(), ++launches);
+    if ((pid = launch(arg->com, id, NULL)) < 0)
+        return;
+    for (int i = 0; i < RESERVE_SLOTS; i++) { // a free or expired slot, else the oldest
+        if (!slots[i].time || now - slots[i].time > SLOT_TIMEOUT) {
+            s = &slots[i];
+            break;
+        }
+        if (!s || slots[i].time < s->time)
+            s = &slots[i];
+    }
+    *s = (slot){ .pid = pid, .desktop = arg->i, .target = d->current ? d->current->win : 0, .time = now };
+    strcpy(s->id, id);
+    DEBUGP("spawnon: slot for pid %d on desktop %d\n", pid, arg->i);
+    #else
+    launch(arg->com, NULL, NULL);
+    #endif
 }
 
 void splitwindows(client *n, client *o, const desktop *d, const monitor *m)
@@ -2302,6 +6527,8 @@ void splitwindows(client *n, client *o, const desktop *d, const monitor *m)
         default:
             break;
     }
+    geomtile(d, n);
+    geomtile(d, o);
 
     if(m) {
         SETWINDOW(o, d, m);
@@ -2336,21 +6563,30 @@ void switch_mode(const Arg *arg) {
 }
 
 #if MENU
-void text_draw (xcb_gcontext_t gc, xcb_window_t window, int16_t x1, int16_t y1, const char *label) {
-    //xcb_void_cookie_t    cookie_gc;
-    xcb_void_cookie_t    cookie_text;
-    xcb_generic_error_t *error;
-    uint8_t              length;
+// draw a label, errors show up as events instead of waiting for them here
+void text_draw (xcb_gcontext_t gc, xcb_drawable_t drawable, int16_t x1, int16_t y1, const char *label) {
+    size_t length = strlen(label);
+
+    xb->text(length > 255 ? 255 : length, drawable, gc, x1, y1, label);
+}
+#endif
 
-    length = strlen(label);
+#if RESERVE_SLOTS
+// the slot held for a window with this pid or startup id, it is free again
+// once returned. idlen is the length of id, which need not be terminated
+slot* takeslot(pid_t pid, const char *id, int idlen) {
+    int64_t now = mstime();
 
-    cookie_text = xcb_image_text_8_checked(dis, length, window, gc, x1, y1, label);
-    error = xcb_request_check(dis, cookie_text);
-    if (error) {
-        fprintf(stderr, "ERROR: can't paste text : %d\n", error->error_code);
-        xcb_disconnect(dis);
-        exit(-1);
+    for (int i = 0; i < RESERVE_SLOTS; i++) {
+        slot *s = &slots[i];
+        if (!s->time || now - s->time > SLOT_TIMEOUT)
+            continue;
+        if ((pid && s->pid == pid) || (idlen && idlen < (int)sizeof(s->id) && !strncmp(s->id, id, idlen) && !s->id[idlen])) {
+            s->time = 0;
+            return s;
+        }
     }
+    return NULL;
 }
 #endif
 
@@ -2364,6 +6600,7 @@ void tilenew(client *n, client *o, desktop *d, const monitor *m) {
         if (d->count == 1) {
             DEBUG("tilenew: tiling empty monitor\n");
             n->xp = 0; n->yp = 0; n->wp = 100; n->hp = 100; 
+            geomtile(d, n);
             if (m) {
                 SETWINDOW(n, d, m);
                 if (d->mode == VIDEO) {
@@ -2373,7 +6610,7 @@ void tilenew(client *n, client *o, desktop *d, const monitor *m) {
                     xcb_move_resize(n, d, m); 
                     xcb_lower_window(n->win);
                 }
-            } else xcb_unmap_window(dis, n->win);
+            } else xb->unmap(n->win);
         } else {
             if(o->isfloating)
                 o = clientbehindfloater(d);
@@ -2387,7 +6624,7 @@ void tilenew(client *n, client *o, desktop *d, const monitor *m) {
                     xcb_lower_window(o->win);
                 }
                 else monocle(d, m);
-            } else xcb_unmap_window(dis, n->win);
+            } else xb->unmap(n->win);
         }
     }
 }
@@ -2401,6 +6638,7 @@ void tileremove(client *r, desktop *d, const monitor *m) {
     if((l = clientstotheleft(r, d, true)))
         for(int i = 0; l[i]; i++) {
             l[i]->wp += r->wp;
+            geomtile(d, l[i]);
             if(m) {
                 SETWINDOW(l[i], d, m);
                 if(d->mode == TILE || d->mode == FLOAT)
@@ -2410,6 +6648,7 @@ void tileremove(client *r, desktop *d, const monitor *m) {
     else if((l = clientstothetop(r, d, true)))
         for(int i = 0; l[i]; i++) {
             l[i]->hp += r->hp;
+            geomtile(d, l[i]);
             if(m) {
                 SETWINDOW(l[i], d, m);
                 if(d->mode == TILE || d->mode == FLOAT)
@@ -2420,6 +6659,7 @@ void tileremove(client *r, desktop *d, const monitor *m) {
         for(int i = 0; l[i]; i++) {
             l[i]->xp = r->xp;
             l[i]->wp += r->wp;
+            geomtile(d, l[i]);
             if(m) {
                 SETWINDOW(l[i], d, m);
                 if(d->mode == TILE || d->mode == FLOAT)
@@ -2430,14 +6670,18 @@ void tileremove(client *r, desktop *d, const monitor *m) {
         for(int i = 0; l[i]; i++) {
             l[i]->yp = r->yp;
             l[i]->hp += r->hp;
+            geomtile(d, l[i]);
             if(m) {
                 SETWINDOW(l[i], d, m);
                 if(d->mode == TILE || d->mode == FLOAT)
                     xcb_move_resize(l[i], d, m);
             }
         }
+    #if LAYOUTS
+    else
+        refitslot(r, d);
+    #endif
 
-    free(l);
     DEBUG("tileremove: leaving\n");
 }
 
@@ -2456,6 +6700,33 @@ void unmapnotify(xcb_generic_event_t *e) {
     #endif
 }
 
+#if BAR
+// give every monitor that reserves panel space a bar window filling it,
+// and keep existing bars in place when monitors change
+void updatebars(void) {
+    uint32_t values[3] = { atlas.bg, 1, XCB_EVENT_MASK_EXPOSURE };
+
+    for (monitor *m = mons; m; m = m->next) {
+        if (!m->haspanel)
+            continue;
+        int y = TOP_PANEL ? m->y - PANEL_HEIGHT : m->y + m->h;
+        if (!m->bar) {
+            m->bar = malloc_safe(sizeof(bar));
+            m->bar->win = xb->id();
+            xcb_create_window(dis, XCB_COPY_FROM_PARENT, m->bar->win, screen->root, m->x, y, m->w, PANEL_HEIGHT, 0,
+                              XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual,
+                              XCB_CW_BACK_PIXEL|XCB_CW_OVERRIDE_REDIRECT|XCB_CW_EVENT_MASK, values);
+            xb->map(m->bar->win);
+        } else if (m->bar->x != m->x || m->bar->y != y || m->bar->w != m->w)
+            xb->configure(m->bar->win, XCB_MOVE_RESIZE, (uint32_t[]){ m->x, y, m->w, PANEL_HEIGHT });
+        else
+            continue;
+        m->bar->x = m->x; m->bar->y = y; m->bar->w = m->w;
+        m->bar->damaged = true;
+    }
+}
+#endif
+
 #if PRETTY_PRINT
 void updatedir() {
     desktop *d = &desktops[selmon->curr_dtop];
@@ -2489,30 +6760,182 @@ void updatemode() {
     }
 }
 
-void updatetitle(client *c) {
-    xcb_icccm_get_text_property_reply_t reply;
-    xcb_generic_error_t *err = NULL;
+#endif
 
-    if(!xcb_icccm_get_text_property_reply(dis, xcb_icccm_get_text_property(dis, c->win, netatoms[NET_WM_NAME]), &reply, &err))
-        if(!xcb_icccm_get_text_property_reply(dis, xcb_icccm_get_text_property(dis, c->win, XCB_ATOM_WM_NAME), &reply, &err))
-            return;
+// milliseconds on the monotonic clock, 64 bits as a 32 bit long holds
+// only 24 days of them
+int64_t mstime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-    if(err) {
-        DEBUG("updatetitle: leaving, error\n");
-        free(err);
-        return;
+// microseconds on the monotonic clock, 36 minutes in a 32 bit long
+int64_t ustime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// with -T print how long each phase of setup() took, NULL starts the clock
+// and "total" prints the time since then
+void timephase(const char *phase) {
+    static int64_t start, last;
+    int64_t now;
+
+    if (!timing) return;
+    now = ustime();
+    if (!phase)
+        start = last = now;
+    else if (!strcmp(phase, "total"))
+        fprintf(stderr, "4wm: %-10s %8ldus\n", phase, (long)(now - start));
+    else {
+        fprintf(stderr, "4wm: %-10s %8ldus\n", phase, (long)(now - last));
+        last = now;
     }
+}
+
+// toggle tracing, turning it off keeps what was recorded for dumptrace()
+void toggletrace(const Arg *arg) {
+    (void)arg;
+    tracing = !tracing;
+}
+
+// add a record to the trace ring, the oldest is overwritten once it's full.
+// start is when a timed thing began, from ustime(), or 0
+void tracepoint(int point, xcb_window_t win, int event, int64_t start, uint32_t arg) {
+    int64_t now = ustime();
+    tracerec *r = &tracering[atomic_fetch_add_explicit(&tracehead, 1, memory_order_relaxed) & (TRACE_SIZE - 1)];
+
+    *r = (tracerec){ .time = now, .duration = start ? now - start : 0, .window = win,
+                     .point = point, .event = event, .arg = arg };
+}
+
+#if STATUS
+// the shared copy of a title, with one more reference
+const char* interntitle(const char *str, int len) {
+    titlestr **b = &titles[fnv(14695981039346656037ULL, str, len) % TITLE_BUCKETS], *t;
 
-    // TODO: encoding
-    if(!reply.name || !reply.name_len)
+    for (t = *b; t; t = t->next)
+        if (t->len == len && !memcmp(t->str, str, len)) {
+            t->refs++;
+            return t->str;
+        }
+    t = malloc_safe(sizeof(titlestr) + len + 1);
+    t->refs = 1;
+    t->len = len;
+    memcpy(t->str, str, len);
+    t->next = *b;
+    *b = t;
+    return t->str;
+}
+
+// drop a reference to a title from interntitle(), NULL is ignored
+void releasetitle(const char *str) {
+    titlestr *t, **p;
+
+    if (!str)
         return;
-     
-    free(c->title);
-    c->title = malloc_safe(reply.name_len+1);  
-    strncpy(c->title, reply.name, reply.name_len); 
-    xcb_icccm_get_text_property_reply_wipe(&reply);
+    t = (titlestr *)(str - offsetof(titlestr, str));
+    if (--t->refs)
+        return;
+    for (p = &titles[fnv(14695981039346656037ULL, str, t->len) % TITLE_BUCKETS]; *p != t; p = &(*p)->next);
+    *p = t->next;
+    free(t);
+}
+
+// ask for both _NET_WM_NAME and WM_NAME at once, the replies are picked
+// up by updatetitles() on a later commit, or when run() is idle
+void requesttitle(client *c) {
+    c->titlereq[0] = xcb_get_property_unchecked(dis, 0, c->win, netatoms[NET_WM_NAME], XCB_GET_PROPERTY_TYPE_ANY, 0, 256).sequence;
+    c->titlereq[1] = xcb_get_property_unchecked(dis, 0, c->win, XCB_ATOM_WM_NAME, XCB_GET_PROPERTY_TYPE_ANY, 0, 256).sequence;
+    c->titlepending = true;
+    c->titlestale = false;
+    c->titletime = mstime();
+}
+
+// a title is shown if the client is focused on a visible desktop
+bool titleshown(const client *c) {
+    for (monitor *m = mons; m; m = m->next)
+        if (desktops[m->curr_dtop].current == c)
+            return true;
+    return false;
+}
+
+// milliseconds until a shown title may be fetched again, -1 if none waits
+int titletimeout(void) {
+    int64_t now = mstime(), t = -1;
+    client *c;
+
+    for (monitor *m = mons; m; m = m->next)
+        if ((c = desktops[m->curr_dtop].current) && c->titlestale && !c->titlepending) {
+            long left = c->titletime + TITLE_INTERVAL - now;
+            if (left < 0) left = 0;
+            if (t < 0 || left < t) t = left;
+        }
+    return t;
+}
+
+// whether a title was asked for and the reply not picked up yet
+bool titlespending(void) {
+    for (int i = 0; i < DESKTOPS; i++)
+        for (client *c = desktops[i].head; c; c = c->next)
+            if (c->titlepending)
+                return true;
+    return false;
+}
+
+// pick up title replies that have arrived, or with wait all that were asked
+// for, and request the shown titles that are stale and whose interval has
+// passed
+//
+// returns true if a title that is shown changed
+bool updatetitles(bool wait) {
+    xcb_get_property_reply_t *r[2] = { NULL, NULL };
+    xcb_generic_error_t *e = NULL;
+    bool changed = false;
+    int64_t now = mstime();
+    client *c;
+
+    for (int i = 0; i < DESKTOPS; i++)
+        for (c = desktops[i].head; c; c = c->next) {
+            // replies arrive in order, once WM_NAME is there so is _NET_WM_NAME
+            if (!c->titlepending)
+                continue;
+            if (wait)
+                r[1] = XREPLY(xcb_wait_for_reply(dis, c->titlereq[1], &e));
+            else if (!xcb_poll_for_reply(dis, c->titlereq[1], (void**)&r[1], &e))
+                continue;
+            free(e); e = NULL;
+            xcb_poll_for_reply(dis, c->titlereq[0], (void**)&r[0], &e);
+            free(e); e = NULL;
+            c->titlepending = false;
+
+            xcb_get_property_reply_t *reply = (r[0] && xcb_get_property_value_length(r[0])) ? r[0] : r[1];
+            if (reply && xcb_get_property_value_length(reply) > 0) {
+                int len = xcb_get_property_value_length(reply);
+                // TODO: encoding
+                if (!c->title || strlen(c->title) != (size_t)len || memcmp(c->title, xcb_get_property_value(reply), len)) {
+                    const char *old = c->title;
+                    c->title = interntitle(xcb_get_property_value(reply), len);
+                    releasetitle(old);
+                    changed |= titleshown(c);
+                }
+            }
+            free(r[0]); free(r[1]);
+            r[0] = r[1] = NULL;
+        }
+
+    for (monitor *m = mons; m; m = m->next)
+        if ((c = desktops[m->curr_dtop].current) && c->titlestale && !c->titlepending
+                && now - c->titletime >= TITLE_INTERVAL)
+            requesttitle(c);
+
+    return changed;
 }
+#endif
 
+#if PRETTY_PRINT
 void updatews() { 
     char *tags_ws[] = PP_TAGS_WS;
     char t1[512] = { "" };
@@ -2545,12 +6968,12 @@ client *wintoclient(xcb_window_t w) {
     for (int i = 0; i < DESKTOPS; i++)
         for (c = desktops[i].head; c; c = c->next) {
             if(c->win == w) {
-                DEBUG("wintoclient: leaving, returning found client\n");
+                TRACE(TP_WINTOCLIENT, w, 0, 0, 1);
                 return c;
             }
         }
    
-    DEBUG("wintoclient: leaving, returing NULL\n");
+    TRACE(TP_WINTOCLIENT, w, 0, 0, 0);
     return NULL;
 }
 
@@ -2575,24 +6998,211 @@ monitor *wintomon(xcb_window_t w) {
     return NULL;
 }
 
+#if METRICS
+/* write every counter to $XDG_RUNTIME_DIR/4wm-$DISPLAY.prom in the
+ * Prometheus text format, on SIGUSR1. the names and labels don't change
+ * between versions, new metrics are only ever added
+ */
+void writemetrics(void) {
+    char *dir = getenv("XDG_RUNTIME_DIR"), *display = getenv("DISPLAY");
+    char path[PATH_MAX], tmp[PATH_MAX + 4], name[16], line[256];
+    unsigned long requests, written = 0;
+    FILE *f, *io;
+
+    if (!dir)
+        return;
+    snprintf(path, sizeof(path), "%s/4wm-%s.prom", dir, display ? display : "");
+    for (char *p = path + strlen(dir) + 1; *p; p++)
+        if (*p == '/') *p = '_';
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if (!(f = fopen(tmp, "w"))) {
+        warn("cannot write %s", tmp);
+        return;
+    }
+
+    // xcb numbers every request, a no-op tells how many were sent so far
+    requests = xcb_no_operation(dis).sequence - ++stats.noops;
+    // every write of the process, to the X server, files and pipes alike
+    if ((io = fopen("/proc/self/io", "r"))) {
+        while (fgets(line, sizeof(line), io))
+            if (sscanf(line, "wchar: %lu", &written) == 1)
+                break;
+        fclose(io);
+    }
+
+    fputs("# HELP fourwm_handler_seconds Time spent handling each type of event, and in commit.\n"
+          "# TYPE fourwm_handler_seconds histogram\n", f);
+    for (int t = 0; t < (int)LENGTH(stats.handlers); t++) {
+        const histogram *h = &stats.handlers[t];
+        unsigned long n = 0;
+        if (!h->count)
+            continue;
+        eventname(t, name, sizeof(name));
+        for (int i = 0; i < METRIC_BUCKETS - 1; i++) {
+            n += h->buckets[i];
+            fprintf(f, "fourwm_handler_seconds_bucket{event=\"%s\",le=\"%g\"} %lu\n", name, (1L << i) / 1e6, n);
+        }
+        fprintf(f, "fourwm_handler_seconds_bucket{event=\"%s\",le=\"+Inf\"} %lu\n", name, h->count);
+        fprintf(f, "fourwm_handler_seconds_sum{event=\"%s\"} %g\n", name, h->sum / 1e6);
+        fprintf(f, "fourwm_handler_seconds_count{event=\"%s\"} %lu\n", name, h->count);
+    }
+    #if READER
+    if (stats.queued.count) {
+        unsigned long n = 0;
+        fputs("# HELP fourwm_event_queue_seconds Time events waited between being read off the socket and handled.\n"
+              "# TYPE fourwm_event_queue_seconds histogram\n", f);
+        for (int i = 0; i < METRIC_BUCKETS - 1; i++) {
+            n += stats.queued.buckets[i];
+            fprintf(f, "fourwm_event_queue_seconds_bucket{le=\"%g\"} %lu\n", (1L << i) / 1e6, n);
+        }
+        fprintf(f, "fourwm_event_queue_seconds_bucket{le=\"+Inf\"} %lu\n", stats.queued.count);
+        fprintf(f, "fourwm_event_queue_seconds_sum %g\n", stats.queued.sum / 1e6);
+        fprintf(f, "fourwm_event_queue_seconds_count %lu\n", stats.queued.count);
+    }
+    fprintf(f, "# HELP fourwm_reader_stalls_total Times the event reader found its queue full.\n"
+               "# TYPE fourwm_reader_stalls_total counter\n"
+               "fourwm_reader_stalls_total %lu\n", (unsigned long)stats.readerstalls);
+    #endif
+    fprintf(f, "# HELP fourwm_x_requests_total Requests sent to the X server.\n"
+               "# TYPE fourwm_x_requests_total counter\n"
+               "fourwm_x_requests_total %lu\n"
+               "# HELP fourwm_x_reply_waits_total Replies and request checks waited for.\n"
+               "# TYPE fourwm_x_reply_waits_total counter\n"
+               "fourwm_x_reply_waits_total %lu\n"
+               "# HELP fourwm_x_flushes_total Explicit flushes of the request buffer.\n"
+               "# TYPE fourwm_x_flushes_total counter\n"
+               "fourwm_x_flushes_total %lu\n"
+               "# HELP fourwm_process_written_bytes_total Bytes written by the process, wchar in /proc/self/io.\n"
+               "# TYPE fourwm_process_written_bytes_total counter\n"
+               "fourwm_process_written_bytes_total %lu\n"
+               "# HELP fourwm_retiles_total Desktops retiled.\n"
+               "# TYPE fourwm_retiles_total counter\n"
+               "fourwm_retiles_total %lu\n"
+               "# HELP fourwm_configures_total Windows moved or resized.\n"
+               "# TYPE fourwm_configures_total counter\n"
+               "fourwm_configures_total %lu\n"
+               "# HELP fourwm_allocations_total Allocations through malloc_safe.\n"
+               "# TYPE fourwm_allocations_total counter\n"
+               "fourwm_allocations_total %lu\n"
+               "# HELP fourwm_crossings_ignored_total EnterNotify caused by windows moving under the pointer.\n"
+               "# TYPE fourwm_crossings_ignored_total counter\n"
+               "fourwm_crossings_ignored_total %lu\n",
+               requests, stats.replywaits, stats.flushes, written, stats.retiles, stats.configures, stats.allocs,
+               stats.crossingsignored);
+    fputs("# HELP fourwm_low_latency Settings of -l that took effect.\n"
+          "# TYPE fourwm_low_latency gauge\n", f);
+    for (int i = 0; i < 5; i++)
+        fprintf(f, "fourwm_low_latency{setting=\"%s\"} %d\n", (const char*[]){ "realtime", "nice", "locked", "lockfuture", "prefaulted" }[i], !!(stats.latency & 1 << i));
+    if (fclose(f) == EOF || rename(tmp, path) < 0)
+        warn("cannot write %s", path);
+}
+#endif
+
 int main(int argc, char *argv[]) {
-    int default_screen;
-    if (argc == 2 && argv[1][0] == '-') {
-        switch (argv[1][1]) { 
+    int default_screen, fd = -1;
+    const char *replayfile = NULL;
+    int soakrounds = 0;
+    const char *recordpath = NULL;
+    bool latency = false;
+    argv0 = argv[0];
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] != '-' || !argv[i][1] || argv[i][2])
+            errx(EXIT_FAILURE, "%s", USAGE);
+        switch (argv[i][1]) { 
             case 'v': errx(EXIT_SUCCESS, "by dct");
             case 'h': errx(EXIT_SUCCESS, "%s", USAGE);
+            case 'T': timing = true; break;
+            case 't': tracing = true; break;
+            case 'l': latency = true; break;
+            case 'd':
+                if (++i == argc) errx(EXIT_FAILURE, "%s", USAGE);
+                return decodetrace(argv[i]);
+            case 'r':
+                if (++i == argc) errx(EXIT_FAILURE, "%s", USAGE);
+                recordpath = argv[i];
+                break;
+            case 'p':
+                if (++i == argc) errx(EXIT_FAILURE, "%s", USAGE);
+                replayfile = argv[i];
+                break;
+            case 'b':
+                if (++i == argc) errx(EXIT_FAILURE, "%s", USAGE);
+                return bench(atoi(argv[i]));
+            case 'S':
+                if (++i == argc) errx(EXIT_FAILURE, "%s", USAGE);
+                soakrounds = atoi(argv[i]);
+                break;
+            #if MENU_SEARCH
+            case 'P': // from updatepathindex(), not for users
+                if (pathindexfile()) {
+                    loadpathindex();
+                    buildpathindex(pathsignature());
+                }
+                return EXIT_SUCCESS;
+            #endif
+            case 'R': // from restart(), not for users
+                if (++i == argc) errx(EXIT_FAILURE, "%s", USAGE);
+                statefd = atoi(argv[i]);
+                break;
             default: errx(EXIT_FAILURE, "%s", USAGE);
         }
-    } else if (argc != 1) 
-        errx(EXIT_FAILURE, "%s", USAGE);
+    }
+    // before setup() so it runs locked too. restart() passes -l on, the
+    // policy would survive exec but the locks and stats.latency would not
+    if (latency)
+        lowlatency();
+    if (replayfile)
+        return replay(replayfile);
+    // a restarted 4wm goes on with the recording of the one before
+    if (recordpath && (!(recordfile = fopen(recordpath, statefd < 0 ? "we" : "ae"))
+                       || fseek(recordfile, 0, SEEK_END) < 0))
+        err(EXIT_FAILURE, "cannot open %s", recordpath);
     if (xcb_connection_has_error((dis = xcb_connect(NULL, &default_screen))))
         errx(EXIT_FAILURE, "error: cannot open display\n");
-    if (setup(default_screen) != -1) {
+    bool ready = setup(default_screen) != -1;
+    if (ready && soakrounds > 0)
+        retval = soak(soakrounds);
+    else if (ready) {
       #if PRETTY_PRINT
       desktopinfo(); // zero out every desktop on (re)start
       #endif
+      if (recordfile && ftell(recordfile) > 0)
+          recordstart = ustime();
+      else if (recordfile) {
+          recordhdr h = { .magic = RECORD_MAGIC, .version = RECORD_VERSION, .root = screen->root, .randr = randrbase,
+                          .width = screen->width_in_pixels, .height = screen->height_in_pixels };
+          recordstart = ustime();
+          if (fwrite(&h, sizeof(h), 1, recordfile) != 1)
+              err(EXIT_FAILURE, "cannot record");
+      }
+      #if READER
+      startreader();
+      #endif
       run();
+      if (recordfile)
+          fclose(recordfile);
     }
+    if (restarting)
+        fd = savestate();
     cleanup(); 
+    if (restarting) {
+        char arg[16], *args[argc + 3];
+        int n = 0;
+        snprintf(arg, sizeof(arg), "%d", fd);
+        // the same flags again, with the state instead of the old one. without
+        // a state the new 4wm adopts the windows cleanup() left
+        for (int i = 0; i < argc; i++)
+            if (!strcmp(argv[i], "-R") && i + 1 < argc)
+                i++;
+            else
+                args[n++] = argv[i];
+        if (fd >= 0) {
+            args[n++] = "-R";
+            args[n++] = arg;
+        }
+        args[n] = NULL;
+        execvp(argv[0], args);
+        err(EXIT_FAILURE, "cannot restart %s", argv[0]);
+    }
     return retval;
 }
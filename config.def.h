@@ -57,6 +57,30 @@
 // the default size of the gap between windows in pixels
 #define GAP             8
 
+// publish desktop and monitor state to $XDG_RUNTIME_DIR/4wm-$DISPLAY.state
+// for panels and pagers, 1 = on, 0 = off
+#define SNAPSHOT        1
+
+// time every event handler and count X requests, round trips, flushes,
+// configures and allocations. SIGUSR1 writes them to
+// $XDG_RUNTIME_DIR/4wm-$DISPLAY.prom, 1 = on, 0 = off
+#define METRICS         1
+// debugging, time every wait for the X server and print where 4wm waited,
+// from which handler and for how long when it exits, 1 = on, 0 = off
+#define AUDIT           0
+// read events off the X socket in a thread of its own, so the server is
+// never held up while 4wm waits for a reply or lays out windows, and with
+// METRICS time how long events wait to be handled, 1 = on, 0 = off
+#define READER          0
+// with -l, the SCHED_FIFO priority 4wm asks for, and the nice value it
+// settles for when realtime scheduling is not allowed
+#define LATENCY_PRIORITY    10
+#define LATENCY_NICE_VALUE  -10
+
+// minimum time between two title fetches of a window in ms, titles of
+// windows that aren't focused on a visible desktop are not fetched at all
+#define TITLE_INTERVAL  250
+
 // pretty print, 1 = on, 0 = off
 #define PRETTY_PRINT 0
 #if PRETTY_PRINT
@@ -73,9 +97,39 @@
 #define PP_PRINTF printf("%s %s %s ^fg(%s)%s\n", pp.ws, pp.mode, pp.dir, PP_COL_TITLE, d->current ? d->current->title :"");
 #endif
 
+// built-in status bar, drawn by 4wm in the panel space reserved by
+// PANEL_HEIGHT and TOP_PANEL, 1 = on, 0 = off
+#define BAR 0
+#if BAR
+// must be a fixed width font
+#define BAR_FONT        "7x13"
+#define BAR_COL_BG      "#000000"
+#define BAR_COL_CURRENT "#005FFF"
+#define BAR_COL_VISIBLE "#FFFFFF"
+#define BAR_COL_HIDDEN  "#262626"
+#define BAR_COL_DIR     "#00FF5F"
+#define BAR_COL_MODE    "#AF00FF"
+#define BAR_COL_TITLE   "#FFFFFF"
+// NULL workspace tags are shown as the desktop number
+#define BAR_TAGS_WS     { "1", "2", "3", "4", "5", "6", "7", "8", "9" }
+// in the order TILE MONOCLE VIDEO FLOAT
+#define BAR_TAGS_MODE   { "[T]", "[M]", "[V]", "[F]" }
+// in the order TLEFT TRIGHT TBOTTOM TTOP
+#define BAR_TAGS_DIR    { "<", ">", "v", "^" }
+#endif
+
 // helper for spawning shell commands
 #define SHCMD(cmd) {.com = (const char*[]){"/bin/sh", "-c", cmd, NULL}}
 
+// hold the tile a spawned window will take until it maps, so it goes straight
+// there even if you moved on. 0 = off, else how many launches can be pending
+#define RESERVE_SLOTS 8
+
+// named layouts of the tiles of a desktop, saved under
+// $XDG_CONFIG_HOME/4wm/layouts, 1 = on, 0 = off
+#define LAYOUTS 1
+#define LAYOUT(name) {.com = (const char*[]){name, NULL}}
+
 // custom commands, must always end with ', NULL };'
 static const char *termcmd[] = { "xterm",     NULL };
 static const char *webbrowsercmd[] = { "chromium", NULL };
@@ -85,6 +139,11 @@ static const char *webbrowsercmd[] = { "chromium", NULL };
 #if MENU
 static char *menu1[] = { "xterm", "chromium", "firefox", "libreoffice", "mupen64plus", NULL };
 #define MENUS { menu1, NULL }
+// type while a menu is open to search every executable on $PATH,
+// ranked by how often it was launched, 1 = on, 0 = off
+#define MENU_SEARCH 1
+// number of search results shown
+#define MENU_RESULTS 10
 #endif
 
 #define DESKTOPCHANGE(K,N) \
@@ -147,10 +206,23 @@ static Key keys[] = {
     {  MOD1|SHIFT,      XK_q,           quit,               {.i = 0}},
     // quit with exit value 1
     {  MOD1|CONTROL,    XK_q,           quit,               {.i = 1}},
+    // restart in place, e.g. after installing a new build
+    {  MOD1|CONTROL,    XK_r,           restart,            {NULL}},
+    // start or stop recording a trace, SIGUSR2 writes it out
+    {  MOD1|CONTROL,    XK_t,           toggletrace,        {NULL}},
+    #if LAYOUTS
+    // save the tiles of this desktop as a layout, and apply it
+    {  MOD4|SHIFT,      XK_1,           savelayout,         LAYOUT("one")},
+    {  MOD4,            XK_1,           applylayout,        LAYOUT("one")},
+    {  MOD4|SHIFT,      XK_2,           savelayout,         LAYOUT("two")},
+    {  MOD4,            XK_2,           applylayout,        LAYOUT("two")},
+    #endif
     // launch menu
     {  MOD1|CONTROL,    XK_m,           launchmenu,         {.list = menu1}},
     // launch xterm
     {  MOD1|SHIFT,      XK_Return,      spawn,              {.com = termcmd}},
+    // open a terminal on desktop 2 without leaving this one
+    {  MOD1|CONTROL,    XK_Return,      spawnon,            {.com = termcmd, .i = 1}},
     // launch web browser
     {  MOD1|SHIFT,      XK_f,           spawn,              {.com = webbrowsercmd}},
 